@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "model.h"
+
+using namespace std;
+
+// Owns every Model in the process, keyed by canonical path. Asking for a file that is already
+// loaded returns the existing instance, so extra targets or towers cost no import time or memory.
+class AssetManager
+{
+public:
+    /*  Functions  */
+    static AssetManager &Instance( )
+    {
+        static AssetManager manager;
+        return manager;
+    }
+
+    // Returns the shared model for path, importing it on first use. streams are the vertex attributes the
+    // caller's shaders read; an already loaded model is extended to cover them.
+    shared_ptr<Model> LoadModel( const string &path, VertexStreamMask streams = STREAM_ALL )
+    {
+        string key = TextureRegistry::CanonicalPath( path );
+        map<string, shared_ptr<Model> >::iterator found = this->models.find( key );
+
+        if( found != this->models.end( ) )
+        {
+            found->second->RequireStreams( streams );
+            return found->second;
+        }
+
+        shared_ptr<Model> model = make_shared<Model>( path, streams );
+        this->models[key] = model;
+
+        return model;
+    }
+
+    // Drops models nobody outside the manager holds anymore.
+    void Collect( )
+    {
+        for ( map<string, shared_ptr<Model> >::iterator it = this->models.begin( ); it != this->models.end( ); )
+        {
+            if( it->second.use_count( ) == 1 )
+            {
+                it = this->models.erase( it );
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // Drops every model the manager holds. Call before the GL context goes away, the manager itself
+    // outlives main and can't free GPU memory from its destructor.
+    void Clear( )
+    {
+        this->models.clear( );
+    }
+
+    // Prints system and video memory per asset.
+    void PrintReport( ) const
+    {
+        size_t cpuTotal = 0, gpuTotal = 0;
+
+        for ( map<string, shared_ptr<Model> >::const_iterator it = this->models.begin( ); it != this->models.end( ); ++it )
+        {
+            size_t cpu = it->second->CpuBytes( );
+            size_t gpu = it->second->GpuBytes( );
+            cpuTotal += cpu;
+            gpuTotal += gpu;
+
+            printf( "ASSETS:: %-56s %3u meshes  cpu %8.2f MB  gpu %8.2f MB  refs %ld\n", it->first.c_str( ), it->second->MeshCount( ),
+                    cpu / ( 1024.0 * 1024.0 ), gpu / ( 1024.0 * 1024.0 ), it->second.use_count( ) - 1 );
+        }
+
+        printf( "ASSETS:: %u models  cpu %.2f MB  gpu %.2f MB (shared textures counted per model)\n", ( unsigned )this->models.size( ),
+                cpuTotal / ( 1024.0 * 1024.0 ), gpuTotal / ( 1024.0 * 1024.0 ) );
+    }
+
+private:
+    /*  Manager Data  */
+    map<string, shared_ptr<Model> > models;
+
+    AssetManager( ) { }
+    AssetManager( const AssetManager & );
+    AssetManager &operator=( const AssetManager & );
+};
@@ -93,7 +93,6 @@ public:
         {
             this->position += this->right * velocity;
         }
-		this->position.y = 0.0f;
     }
     
     // Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "glresource.h"
+#include "glstate.h"
+
+// Binding points of the uniform blocks shared by every program. Shader's constructor points each block it finds here.
+enum UniformBlockBinding
+{
+    CAMERA_BLOCK_BINDING = 0
+};
+
+/*  std140 image of the block every camera-space shader declares:
+    layout (std140) uniform Camera
+    {
+        mat4 view;
+        mat4 projection;
+        mat4 viewProjection;
+        vec3 cameraPos;
+        float time;
+    }; */
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 cameraPos;
+    GLfloat time;
+};
+
+static_assert( sizeof( CameraBlock ) == 208, "CameraBlock must match the std140 layout of the Camera block" );
+
+// The Camera uniform buffer, filled once per frame and left bound at CAMERA_BLOCK_BINDING.
+class CameraUniforms
+{
+public:
+    /*  Functions  */
+    CameraUniforms( )
+    {
+        this->buffer = GLBuffer::Create( );
+        GLState::Instance( ).BindBufferBase( GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, this->buffer );
+        glBufferData( GL_UNIFORM_BUFFER, sizeof( CameraBlock ), NULL, GL_DYNAMIC_DRAW );
+    }
+
+    void Update( const glm::mat4 &view, const glm::mat4 &projection, glm::vec3 cameraPos, GLfloat time )
+    {
+        this->block.view = view;
+        this->block.projection = projection;
+        this->block.viewProjection = projection * view;
+        this->block.cameraPos = cameraPos;
+        this->block.time = time;
+
+        // Respecifying the whole store lets the driver hand out fresh memory instead of waiting on last frame's draws
+        GLState::Instance( ).BindBuffer( GL_UNIFORM_BUFFER, this->buffer );
+        glBufferData( GL_UNIFORM_BUFFER, sizeof( CameraBlock ), &this->block, GL_DYNAMIC_DRAW );
+    }
+
+    const CameraBlock &Block( ) const
+    {
+        return this->block;
+    }
+
+private:
+    /*  Uniform Data  */
+    GLBuffer buffer;
+    CameraBlock block;
+};
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+#include <LinearMath/btConvexHull.h>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "meshcache.h"
+#include "model.h"
+
+using namespace std;
+
+// Bump whenever the layout below or the way hulls are simplified changes.
+const uint32_t HULL_CACHE_VERSION = 1;
+const char HULL_CACHE_MAGIC[4] = { 'G', 'L', 'H', 'L' };
+
+// Hull vertices per Mesh unless asked otherwise.
+const GLuint DEFAULT_HULL_VERTICES = 32;
+
+/*  On-disk layout: HullCacheHeader, then for every part a uint32_t point count followed by that many
+    x, y, z floats. A hull is only valid for the triangles and the vertex budget it was built with. */
+struct HullCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t geometryHash;
+    uint32_t vertexBudget;
+    uint32_t partCount;
+    // How long the hulls took to build, so a cached load can report what it saved
+    double buildSeconds;
+};
+
+/*  Simplified convex hulls of a Model, one per Mesh, in model space. Like btShapeHull the points are
+    first reduced to the support points along a set of directions spread over the sphere, then Bullet's
+    HullLibrary grows the hull from those; here the direction count follows the vertex budget rather than
+    btShapeHull's fixed 42, and the budget caps the vertices each hull keeps.
+
+    Only the hull points are kept. PhysicsWorld::AddHull makes a btConvexHullShape of each for every body,
+    a shape's scale is its own and bodies don't share them. The points are cached next to the model's
+    source, like the mesh and BVH caches. */
+class CollisionHull
+{
+public:
+    /*  Functions  */
+    // The model is asked to keep its CPU geometry, the hulls are built from its vertices.
+    explicit CollisionHull( Model &model, GLuint vertexBudget = DEFAULT_HULL_VERTICES )
+        : vertexBudget( std::max( vertexBudget, 4u ) ), cached( false ), seconds( 0.0 ), buildSeconds( 0.0 ),
+          path( CollisionHull::CachePath( model.Path( ) ) )
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now( );
+        model.RequireCpuGeometry( );
+
+        uint64_t hash = 14695981039346656037ULL;
+        const vector<Mesh> &meshes = model.Meshes( );
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            hash = HashBytes( ( const unsigned char * )meshes[i].vertices.data( ), meshes[i].vertices.size( ) * sizeof( Vertex ), hash );
+        }
+
+        GLuint partCount = 0;
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            partCount += meshes[i].vertices.empty( ) ? 0 : 1;
+        }
+
+        if( this->load( hash, partCount ) )
+        {
+            this->cached = true;
+        }
+        else
+        {
+            for ( GLuint i = 0; i < meshes.size( ); i++ )
+            {
+                if( !meshes[i].vertices.empty( ) )
+                {
+                    this->parts.push_back( this->build( meshes[i] ) );
+                }
+            }
+            this->buildSeconds = chrono::duration<double>( chrono::steady_clock::now( ) - start ).count( );
+            this->save( hash );
+        }
+        this->seconds = chrono::duration<double>( chrono::steady_clock::now( ) - start ).count( );
+    }
+
+    // Hull points of every part, in model space.
+    const vector<vector<glm::vec3> > &Parts( ) const
+    {
+        return this->parts;
+    }
+
+    GLuint VertexCount( ) const
+    {
+        GLuint count = 0;
+        for ( size_t i = 0; i < this->parts.size( ); i++ )
+        {
+            count += ( GLuint )this->parts[i].size( );
+        }
+        return count;
+    }
+
+    // Cache files live next to the source asset, like the mesh cache.
+    static string CachePath( const string &sourcePath )
+    {
+        return sourcePath + ".hullcache";
+    }
+
+    // Prints the hull sizes and, for cached hulls, the build time they saved.
+    void PrintReport( ) const
+    {
+        if( this->cached )
+        {
+            printf( "PHYSICS:: %s: %u hulls, %u vertices (budget %u each), from cache in %.2f ms, cold build %.2f ms\n", this->path.c_str( ),
+                    ( GLuint )this->parts.size( ), this->VertexCount( ), this->vertexBudget, this->seconds * 1000.0, this->buildSeconds * 1000.0 );
+        }
+        else
+        {
+            printf( "PHYSICS:: %s: %u hulls, %u vertices (budget %u each), built in %.2f ms\n", this->path.c_str( ),
+                    ( GLuint )this->parts.size( ), this->VertexCount( ), this->vertexBudget, this->seconds * 1000.0 );
+        }
+    }
+
+private:
+    /*  Hull Data  */
+    vector<vector<glm::vec3> > parts;
+    GLuint vertexBudget;
+    bool cached;
+    double seconds;
+    double buildSeconds;
+    string path;
+
+    /*  Functions   */
+    vector<glm::vec3> build( const Mesh &mesh ) const
+    {
+        // Support points along four directions per vertex of budget, on a Fibonacci spiral
+        GLuint directionCount = std::max( this->vertexBudget * 4, 42u );
+        vector<btVector3> support;
+        support.reserve( directionCount );
+        const GLfloat goldenAngle = 2.39996323f;
+        for ( GLuint d = 0; d < directionCount; d++ )
+        {
+            GLfloat y = 1.0f - 2.0f * ( d + 0.5f ) / directionCount;
+            GLfloat radius = sqrt( 1.0f - y * y );
+            glm::vec3 direction( radius * cos( goldenAngle * d ), y, radius * sin( goldenAngle * d ) );
+
+            GLuint best = 0;
+            GLfloat bestDot = glm::dot( mesh.vertices[0].Position, direction );
+            for ( GLuint v = 1; v < mesh.vertices.size( ); v++ )
+            {
+                GLfloat dot = glm::dot( mesh.vertices[v].Position, direction );
+                if( dot > bestDot )
+                {
+                    best = v;
+                    bestDot = dot;
+                }
+            }
+            const glm::vec3 &point = mesh.vertices[best].Position;
+            support.push_back( btVector3( point.x, point.y, point.z ) );
+        }
+
+        HullDesc desc( QF_TRIANGLES, ( unsigned int )support.size( ), &support[0], sizeof( btVector3 ) );
+        desc.mMaxVertices = this->vertexBudget;
+        HullLibrary library;
+        HullResult result;
+        vector<glm::vec3> hull;
+        if( library.CreateConvexHull( desc, result ) == QE_OK )
+        {
+            for ( unsigned int i = 0; i < result.mNumOutputVertices; i++ )
+            {
+                const btVector3 &point = result.m_OutputVertices[i];
+                hull.push_back( glm::vec3( point.x( ), point.y( ), point.z( ) ) );
+            }
+            library.ReleaseResult( result );
+        }
+        else
+        {
+            // Flat or degenerate parts fall back to the support points themselves
+            for ( size_t i = 0; i < support.size( ) && hull.size( ) < this->vertexBudget; i++ )
+            {
+                hull.push_back( glm::vec3( support[i].x( ), support[i].y( ), support[i].z( ) ) );
+            }
+        }
+        return hull;
+    }
+
+    // Reads the cached hulls, one per non-empty mesh. Anything that doesn't match the model or the budget, or
+    // leaves bytes unread, is ignored.
+    bool load( uint64_t hash, GLuint partCount )
+    {
+        ifstream in( this->path.c_str( ), ios::binary );
+        HullCacheHeader header;
+        if( !in || !in.read( ( char * )&header, sizeof( header ) ) )
+        {
+            return false;
+        }
+        if( memcmp( header.magic, HULL_CACHE_MAGIC, 4 ) != 0 || header.version != HULL_CACHE_VERSION ||
+            header.geometryHash != hash || header.vertexBudget != this->vertexBudget || header.partCount != partCount )
+        {
+            return false;
+        }
+
+        vector<vector<glm::vec3> > loaded( header.partCount );
+        for ( uint32_t i = 0; i < header.partCount; i++ )
+        {
+            uint32_t count = 0;
+            if( !in.read( ( char * )&count, sizeof( count ) ) || count > header.vertexBudget )
+            {
+                return false;
+            }
+            loaded[i].resize( count );
+            if( count > 0 && !in.read( ( char * )&loaded[i][0], count * sizeof( glm::vec3 ) ) )
+            {
+                return false;
+            }
+        }
+        if( in.peek( ) != char_traits<char>::eof( ) )
+        {
+            return false;
+        }
+        this->parts.swap( loaded );
+        this->buildSeconds = header.buildSeconds;
+        return true;
+    }
+
+    // Written under a temporary name and renamed into place, like the mesh cache.
+    void save( uint64_t hash ) const
+    {
+        HullCacheHeader header;
+        memcpy( header.magic, HULL_CACHE_MAGIC, 4 );
+        header.version = HULL_CACHE_VERSION;
+        header.geometryHash = hash;
+        header.vertexBudget = this->vertexBudget;
+        header.partCount = ( uint32_t )this->parts.size( );
+        header.buildSeconds = this->buildSeconds;
+
+        string tempPath = this->path + ".tmp";
+        ofstream out( tempPath.c_str( ), ios::binary | ios::trunc );
+        if( out )
+        {
+            out.write( ( const char * )&header, sizeof( header ) );
+            for ( size_t i = 0; i < this->parts.size( ); i++ )
+            {
+                uint32_t count = ( uint32_t )this->parts[i].size( );
+                out.write( ( const char * )&count, sizeof( count ) );
+                if( count > 0 )
+                {
+                    out.write( ( const char * )&this->parts[i][0], count * sizeof( glm::vec3 ) );
+                }
+            }
+            out.close( );
+        }
+
+        if( !out )
+        {
+            remove( tempPath.c_str( ) );
+            cout << "ERROR::HULLCACHE:: could not write " << tempPath << endl;
+            return;
+        }
+        remove( this->path.c_str( ) );
+        if( rename( tempPath.c_str( ), this->path.c_str( ) ) != 0 )
+        {
+            remove( tempPath.c_str( ) );
+        }
+    }
+};
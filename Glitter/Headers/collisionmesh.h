@@ -0,0 +1,290 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <btBulletDynamicsCommon.h>
+#include <glad/glad.h>
+
+#include "meshcache.h"
+#include "model.h"
+
+using namespace std;
+
+// Bump whenever the layout below or the way the triangles are fed to Bullet changes.
+const uint32_t COLLISION_CACHE_VERSION = 1;
+const char COLLISION_CACHE_MAGIC[4] = { 'G', 'L', 'B', 'V' };
+
+/*  On-disk layout: CollisionCacheHeader, then the btOptimizedBvh as written by serializeInPlace, 16 byte
+    aligned. The BVH is only valid for the exact triangles it was built from and the Bullet build that
+    wrote it, so the header pins both. */
+struct CollisionCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t geometryHash;
+    uint32_t triangleCount;
+    uint32_t bvhSize;
+    uint32_t bulletVersion;
+    uint32_t pointerSize;
+    // How long the BVH took to build, so a cached load can report what it saved
+    double buildSeconds;
+};
+
+/*  A static triangle mesh collision shape over a Model's own vertex and index arrays: one btIndexedMesh per
+    Mesh, no copies. Building the btBvhTriangleMeshShape's quantized BVH is the slow part of creating it,
+    so the BVH is serialized next to the model's source the first time and mapped back in place after
+    that. The Model has to outlive the shape, Bullet reads its arrays directly.
+
+    The shape is in model space; PhysicsWorld::AddMesh wraps it in a btScaledBvhTriangleMeshShape for the
+    transform it is drawn with, so one BVH serves any scale. */
+class CollisionMesh
+{
+public:
+    /*  Functions  */
+    // The model is asked to keep its CPU geometry, the shape reads those arrays in place.
+    explicit CollisionMesh( Model &model )
+        : bvhBuffer( nullptr ), bvh( nullptr ), triangleCount( 0 ), cached( false ), seconds( 0.0 ), buildSeconds( 0.0 ),
+          path( CollisionMesh::CachePath( model.Path( ) ) )
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now( );
+        model.RequireCpuGeometry( );
+
+        uint64_t hash = 14695981039346656037ULL;
+        this->triangles.reset( new btTriangleIndexVertexArray( ) );
+        const vector<Mesh> &meshes = model.Meshes( );
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            const Mesh &mesh = meshes[i];
+            if( mesh.indices.Size( ) < 3 )
+            {
+                continue;
+            }
+
+            // Positions are the first member of Vertex, the rest of each vertex is skipped by the stride
+            btIndexedMesh part;
+            part.m_numTriangles = ( int )( mesh.indices.Size( ) / 3 );
+            part.m_triangleIndexBase = ( const unsigned char * )mesh.indices.Data( );
+            part.m_triangleIndexStride = 3 * ( int )IndexArray::TypeSize( mesh.indices.Type( ) );
+            part.m_numVertices = ( int )mesh.vertices.size( );
+            part.m_vertexBase = ( const unsigned char * )mesh.vertices.data( );
+            part.m_vertexStride = sizeof( Vertex );
+            part.m_vertexType = PHY_FLOAT;
+            this->triangles->addIndexedMesh( part, mesh.indices.Type( ) == GL_UNSIGNED_SHORT ? PHY_SHORT : PHY_INTEGER );
+
+            this->triangleCount += part.m_numTriangles;
+            hash = HashBytes( part.m_vertexBase, mesh.vertices.size( ) * sizeof( Vertex ), hash );
+            hash = HashBytes( part.m_triangleIndexBase, mesh.indices.Bytes( ), hash );
+        }
+
+        if( this->triangleCount > 0 && this->load( hash ) )
+        {
+            this->shape.reset( new btBvhTriangleMeshShape( this->triangles.get( ), true, false ) );
+            this->shape->setOptimizedBvh( this->bvh );
+            this->cached = true;
+        }
+        else if( this->triangleCount > 0 )
+        {
+            this->shape.reset( new btBvhTriangleMeshShape( this->triangles.get( ), true, true ) );
+            this->buildSeconds = chrono::duration<double>( chrono::steady_clock::now( ) - start ).count( );
+            this->save( hash );
+        }
+        this->seconds = chrono::duration<double>( chrono::steady_clock::now( ) - start ).count( );
+    }
+
+    // The shape goes before the BVH it points into
+    ~CollisionMesh( )
+    {
+        this->shape.reset( );
+        if( this->bvh )
+        {
+            this->bvh->~btOptimizedBvh( );
+        }
+        btAlignedFree( this->bvhBuffer );
+    }
+
+    CollisionMesh( const CollisionMesh & ) = delete;
+    CollisionMesh &operator=( const CollisionMesh & ) = delete;
+
+    // Null when the model has no triangles.
+    btBvhTriangleMeshShape *Shape( ) const
+    {
+        return this->shape.get( );
+    }
+
+    GLuint TriangleCount( ) const
+    {
+        return this->triangleCount;
+    }
+
+    // Cache files live next to the source asset, like the mesh cache.
+    static string CachePath( const string &sourcePath )
+    {
+        return sourcePath + ".bvhcache";
+    }
+
+    // Prints how the shape was created and, for a cached BVH, the cold build time it saved.
+    void PrintReport( ) const
+    {
+        if( this->cached )
+        {
+            printf( "PHYSICS:: %s: %u triangles, BVH from cache in %.2f ms, cold build %.2f ms (%.1fx)\n", this->path.c_str( ),
+                    this->triangleCount, this->seconds * 1000.0, this->buildSeconds * 1000.0,
+                    this->seconds > 0.0 ? this->buildSeconds / this->seconds : 0.0 );
+        }
+        else
+        {
+            printf( "PHYSICS:: %s: %u triangles, BVH built in %.2f ms\n", this->path.c_str( ), this->triangleCount, this->seconds * 1000.0 );
+        }
+    }
+
+private:
+    /*  Collision Data  */
+    unique_ptr<btTriangleIndexVertexArray> triangles;
+    unique_ptr<btBvhTriangleMeshShape> shape;
+    // A cached BVH lives inside the buffer it was read into
+    void *bvhBuffer;
+    btOptimizedBvh *bvh;
+    GLuint triangleCount;
+    bool cached;
+    double seconds;
+    double buildSeconds;
+    string path;
+
+    /*  Functions   */
+    // Reads the cached BVH and fixes it up in place. Anything that doesn't match the triangles is ignored.
+    bool load( uint64_t hash )
+    {
+        ifstream in( this->path.c_str( ), ios::binary );
+        CollisionCacheHeader header;
+        if( !in || !in.read( ( char * )&header, sizeof( header ) ) )
+        {
+            return false;
+        }
+        // The BVH has to be exactly the rest of the file, never a size taken on trust
+        streamoff start = in.tellg( );
+        in.seekg( 0, ios::end );
+        streamoff remaining = in.tellg( ) - start;
+        in.seekg( start );
+        if( memcmp( header.magic, COLLISION_CACHE_MAGIC, 4 ) != 0 || header.version != COLLISION_CACHE_VERSION ||
+            header.geometryHash != hash || header.triangleCount != this->triangleCount ||
+            header.bulletVersion != BT_BULLET_VERSION || header.pointerSize != sizeof( void * ) ||
+            header.bvhSize < sizeof( btQuantizedBvh ) || ( streamoff )header.bvhSize != remaining )
+        {
+            return false;
+        }
+
+        this->bvhBuffer = btAlignedAlloc( header.bvhSize, 16 );
+        if( !in.read( ( char * )this->bvhBuffer, header.bvhSize ) )
+        {
+            return this->reject( );
+        }
+        this->bvh = btOptimizedBvh::deSerializeInPlace( this->bvhBuffer, header.bvhSize, false );
+        if( !this->bvh || !this->validBvh( header.bvhSize ) )
+        {
+            return this->reject( );
+        }
+        this->buildSeconds = header.buildSeconds;
+        return true;
+    }
+
+    // Whether the mapped BVH is the one Bullet would build over these triangles: a quantized tree of 2n - 1
+    // nodes filling the buffer exactly, whose leaves name real triangles and whose skips and subtrees stay inside it
+    bool validBvh( unsigned bvhSize )
+    {
+        const QuantizedNodeArray &nodes = this->bvh->getQuantizedNodeArray( );
+        int nodeCount = nodes.size( );
+        if( !this->bvh->isQuantized( ) || nodeCount != 2 * ( int )this->triangleCount - 1 ||
+            this->bvh->calculateSerializeBufferSize( ) != bvhSize )
+        {
+            return false;
+        }
+
+        const IndexedMeshArray &parts = this->triangles->getIndexedMeshArray( );
+        for ( int i = 0; i < nodeCount; i++ )
+        {
+            const btQuantizedBvhNode &node = nodes[i];
+            if( node.isLeafNode( ) )
+            {
+                int part = node.getPartId( );
+                if( part >= parts.size( ) || node.getTriangleIndex( ) >= parts[part].m_numTriangles )
+                {
+                    return false;
+                }
+            }
+            else if( node.getEscapeIndex( ) < 1 || node.getEscapeIndex( ) > nodeCount - i )
+            {
+                return false;
+            }
+        }
+
+        const BvhSubtreeInfoArray &subtrees = this->bvh->getSubtreeInfoArray( );
+        for ( int i = 0; i < subtrees.size( ); i++ )
+        {
+            if( subtrees[i].m_rootNodeIndex < 0 || subtrees[i].m_subtreeSize < 1 ||
+                subtrees[i].m_subtreeSize > nodeCount - subtrees[i].m_rootNodeIndex )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool reject( )
+    {
+        if( this->bvh )
+        {
+            this->bvh->~btOptimizedBvh( );
+        }
+        btAlignedFree( this->bvhBuffer );
+        this->bvhBuffer = nullptr;
+        this->bvh = nullptr;
+        return false;
+    }
+
+    // Written under a temporary name and renamed into place, like the mesh cache.
+    void save( uint64_t hash ) const
+    {
+        btOptimizedBvh *built = this->shape->getOptimizedBvh( );
+        CollisionCacheHeader header;
+        memcpy( header.magic, COLLISION_CACHE_MAGIC, 4 );
+        header.version = COLLISION_CACHE_VERSION;
+        header.geometryHash = hash;
+        header.triangleCount = this->triangleCount;
+        header.bvhSize = built->calculateSerializeBufferSize( );
+        header.bulletVersion = BT_BULLET_VERSION;
+        header.pointerSize = sizeof( void * );
+        header.buildSeconds = this->buildSeconds;
+
+        void *buffer = btAlignedAlloc( header.bvhSize, 16 );
+        bool serialized = built->serializeInPlace( buffer, header.bvhSize, false );
+
+        string tempPath = this->path + ".tmp";
+        ofstream out( tempPath.c_str( ), ios::binary | ios::trunc );
+        if( serialized && out )
+        {
+            out.write( ( const char * )&header, sizeof( header ) );
+            out.write( ( const char * )buffer, header.bvhSize );
+            out.close( );
+        }
+        btAlignedFree( buffer );
+
+        if( !serialized || !out )
+        {
+            remove( tempPath.c_str( ) );
+            cout << "ERROR::COLLISIONCACHE:: could not write " << tempPath << endl;
+            return;
+        }
+        remove( this->path.c_str( ) );
+        if( rename( tempPath.c_str( ), this->path.c_str( ) ) != 0 )
+        {
+            remove( tempPath.c_str( ) );
+        }
+    }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+#include <glad/glad.h>
+
+using namespace std;
+
+// CPU time spent building each frame, from the top of the loop to just before the buffer swap so
+// vsync waits are left out. Used by the --bench-* modes in main.
+class FrameTimer
+{
+public:
+    /*  Functions  */
+    FrameTimer( )
+    {
+        this->Reset( );
+    }
+
+    void Reset( )
+    {
+        this->frames = 0;
+        this->totalSeconds = 0.0;
+        this->minSeconds = 0.0;
+        this->maxSeconds = 0.0;
+    }
+
+    void BeginFrame( )
+    {
+        this->frameStart = chrono::steady_clock::now( );
+    }
+
+    void EndFrame( )
+    {
+        double elapsed = chrono::duration<double>( chrono::steady_clock::now( ) - this->frameStart ).count( );
+
+        if( this->frames == 0 || elapsed < this->minSeconds )
+        {
+            this->minSeconds = elapsed;
+        }
+        if( elapsed > this->maxSeconds )
+        {
+            this->maxSeconds = elapsed;
+        }
+        this->totalSeconds += elapsed;
+        this->frames++;
+    }
+
+    GLuint Frames( ) const
+    {
+        return this->frames;
+    }
+
+    double AverageMilliseconds( ) const
+    {
+        return this->frames ? this->totalSeconds * 1000.0 / this->frames : 0.0;
+    }
+
+    void PrintReport( const char *label ) const
+    {
+        printf( "BENCH:: %s: %u frames, cpu avg %.3f ms  min %.3f ms  max %.3f ms\n", label, this->frames,
+                this->AverageMilliseconds( ), this->minSeconds * 1000.0, this->maxSeconds * 1000.0 );
+    }
+
+private:
+    /*  Timer Data  */
+    GLuint frames;
+    double totalSeconds;
+    double minSeconds;
+    double maxSeconds;
+    chrono::steady_clock::time_point frameStart;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#include <xmmintrin.h>
+#define FRUSTUM_CULL_SSE 1
+#endif
+
+using namespace std;
+
+// The six planes of a view volume, normals pointing inwards: a point p is inside a plane when dot( plane.xyz, p ) + plane.w >= 0.
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // Extracts the planes (left, right, bottom, top, near, far) from a view-projection matrix.
+    static Frustum FromMatrix( const glm::mat4 &viewProjection )
+    {
+        // glm is column major, row i of the matrix is ( m[0][i], m[1][i], m[2][i], m[3][i] )
+        glm::vec4 rows[4];
+        for ( int i = 0; i < 4; i++ )
+        {
+            rows[i] = glm::vec4( viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i] );
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];
+        frustum.planes[1] = rows[3] - rows[0];
+        frustum.planes[2] = rows[3] + rows[1];
+        frustum.planes[3] = rows[3] - rows[1];
+        frustum.planes[4] = rows[3] + rows[2];
+        frustum.planes[5] = rows[3] - rows[2];
+        for ( int i = 0; i < 6; i++ )
+        {
+            frustum.planes[i] /= glm::length( glm::vec3( frustum.planes[i] ) );
+        }
+        return frustum;
+    }
+};
+
+// Spheres tested and rejected by the last Cull.
+struct CullStats
+{
+    GLuint tested;
+    GLuint culled;
+};
+
+/*  Frustum culling for bounding spheres, stored structure-of-arrays so four are tested against a plane
+    with one SSE multiply-add chain. Spheres are added each frame; Cull writes one visibility byte per
+    sphere. The arrays keep their capacity between frames. */
+class FrustumCuller
+{
+public:
+    /*  Functions  */
+    explicit FrustumCuller( size_t capacity = 64 )
+    {
+        this->x.reserve( capacity + 3 );
+        this->y.reserve( capacity + 3 );
+        this->z.reserve( capacity + 3 );
+        this->radius.reserve( capacity + 3 );
+        this->count = 0;
+        this->stats.tested = 0;
+        this->stats.culled = 0;
+    }
+
+    void Clear( )
+    {
+        this->x.clear( );
+        this->y.clear( );
+        this->z.clear( );
+        this->radius.clear( );
+        this->count = 0;
+    }
+
+    // Adds a world space sphere, returns its index into Cull's output.
+    GLuint Add( glm::vec3 center, GLfloat radius )
+    {
+        this->x.push_back( center.x );
+        this->y.push_back( center.y );
+        this->z.push_back( center.z );
+        this->radius.push_back( radius );
+        return this->count++;
+    }
+
+    // Sets visible[i] to 1 for every sphere that touches the frustum and 0 for the rest.
+    void Cull( const Frustum &frustum, vector<GLubyte> &visible )
+    {
+        // Pad to a whole number of lanes; the padding is never reported
+        size_t padded = ( this->count + 3 ) & ~( size_t )3;
+        this->x.resize( padded, 0.0f );
+        this->y.resize( padded, 0.0f );
+        this->z.resize( padded, 0.0f );
+        this->radius.resize( padded, 0.0f );
+        visible.resize( padded );
+
+#ifdef FRUSTUM_CULL_SSE
+        for ( size_t i = 0; i < padded; i += 4 )
+        {
+            __m128 px = _mm_loadu_ps( &this->x[i] );
+            __m128 py = _mm_loadu_ps( &this->y[i] );
+            __m128 pz = _mm_loadu_ps( &this->z[i] );
+            __m128 negativeRadius = _mm_sub_ps( _mm_setzero_ps( ), _mm_loadu_ps( &this->radius[i] ) );
+            __m128 inside = _mm_cmpeq_ps( px, px );
+
+            for ( int p = 0; p < 6; p++ )
+            {
+                const glm::vec4 &plane = frustum.planes[p];
+                __m128 distance = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, _mm_set1_ps( plane.x ) ), _mm_mul_ps( py, _mm_set1_ps( plane.y ) ) ),
+                                              _mm_add_ps( _mm_mul_ps( pz, _mm_set1_ps( plane.z ) ), _mm_set1_ps( plane.w ) ) );
+                inside = _mm_and_ps( inside, _mm_cmpge_ps( distance, negativeRadius ) );
+            }
+
+            int mask = _mm_movemask_ps( inside );
+            for ( int lane = 0; lane < 4; lane++ )
+            {
+                visible[i + lane] = ( GLubyte )( ( mask >> lane ) & 1 );
+            }
+        }
+#else
+        for ( size_t i = 0; i < padded; i++ )
+        {
+            GLubyte inside = 1;
+            for ( int p = 0; p < 6; p++ )
+            {
+                const glm::vec4 &plane = frustum.planes[p];
+                GLfloat distance = plane.x * this->x[i] + plane.y * this->y[i] + plane.z * this->z[i] + plane.w;
+                inside &= ( GLubyte )( distance >= -this->radius[i] );
+            }
+            visible[i] = inside;
+        }
+#endif
+
+        this->stats.tested = this->count;
+        this->stats.culled = 0;
+        for ( GLuint i = 0; i < this->count; i++ )
+        {
+            this->stats.culled += visible[i] ? 0 : 1;
+        }
+    }
+
+    GLuint Count( ) const
+    {
+        return this->count;
+    }
+
+    const CullStats &Stats( ) const
+    {
+        return this->stats;
+    }
+
+    // World space sphere around an object space one, for transforms with rotation, translation and any scale.
+    static void TransformSphere( const glm::mat4 &transform, glm::vec3 center, GLfloat radius, glm::vec3 &worldCenter, GLfloat &worldRadius )
+    {
+        worldCenter = glm::vec3( transform * glm::vec4( center, 1.0f ) );
+        GLfloat scale = glm::max( glm::max( glm::length( glm::vec3( transform[0] ) ), glm::length( glm::vec3( transform[1] ) ) ),
+                                  glm::length( glm::vec3( transform[2] ) ) );
+        worldRadius = radius * scale;
+    }
+
+private:
+    /*  Culler Data  */
+    vector<GLfloat> x;
+    vector<GLfloat> y;
+    vector<GLfloat> z;
+    vector<GLfloat> radius;
+    GLuint count;
+    CullStats stats;
+};
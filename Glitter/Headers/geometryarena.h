@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "glresource.h"
+#include "glstate.h"
+#include "indexarray.h"
+#include "vertexformat.h"
+
+using namespace std;
+
+// The most draws one GeometryArena::Draw call takes.
+const GLuint MAX_MULTI_DRAW = 64;
+
+// The record glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER.
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// First-fit sub-allocator over [0, capacity) in whole elements. The free list is kept sorted by offset
+// so a freed range merges with its neighbours.
+class RangeAllocator
+{
+public:
+    /*  Functions  */
+    RangeAllocator( ) : capacity( 0 ) { }
+
+    // Returns false when no free range is large enough, Grow and try again.
+    bool Allocate( GLuint count, GLuint &offset )
+    {
+        if( count == 0 )
+        {
+            offset = 0;
+            return true;
+        }
+
+        for ( size_t i = 0; i < this->ranges.size( ); i++ )
+        {
+            Range &range = this->ranges[i];
+            if( range.count >= count )
+            {
+                offset = range.offset;
+                range.offset += count;
+                range.count -= count;
+                if( range.count == 0 )
+                {
+                    this->ranges.erase( this->ranges.begin( ) + i );
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Free( GLuint offset, GLuint count )
+    {
+        if( count == 0 )
+        {
+            return;
+        }
+
+        size_t i = 0;
+        while( i < this->ranges.size( ) && this->ranges[i].offset < offset )
+        {
+            i++;
+        }
+
+        Range range = { offset, count };
+        this->ranges.insert( this->ranges.begin( ) + i, range );
+
+        // Merge with the following range, then with the preceding one
+        if( i + 1 < this->ranges.size( ) && this->ranges[i].offset + this->ranges[i].count == this->ranges[i + 1].offset )
+        {
+            this->ranges[i].count += this->ranges[i + 1].count;
+            this->ranges.erase( this->ranges.begin( ) + i + 1 );
+        }
+        if( i > 0 && this->ranges[i - 1].offset + this->ranges[i - 1].count == this->ranges[i].offset )
+        {
+            this->ranges[i - 1].count += this->ranges[i].count;
+            this->ranges.erase( this->ranges.begin( ) + i );
+        }
+    }
+
+    // Appends [capacity, newCapacity) to the free space.
+    void Grow( GLuint newCapacity )
+    {
+        this->Free( this->capacity, newCapacity - this->capacity );
+        this->capacity = newCapacity;
+    }
+
+    void Reset( )
+    {
+        this->ranges.clear( );
+        this->capacity = 0;
+    }
+
+    GLuint Capacity( ) const
+    {
+        return this->capacity;
+    }
+
+    GLuint FreeCount( ) const
+    {
+        GLuint total = 0;
+        for ( size_t i = 0; i < this->ranges.size( ); i++ )
+        {
+            total += this->ranges[i].count;
+        }
+        return total;
+    }
+
+private:
+    struct Range
+    {
+        GLuint offset;
+        GLuint count;
+    };
+
+    /*  Allocator Data  */
+    vector<Range> ranges;
+    GLuint capacity;
+};
+
+class GeometryArena;
+
+// A mesh's slice of a GeometryArena, given back when the range goes away. Indices are relative to baseVertex.
+class GeometryRange
+{
+public:
+    /*  Functions  */
+    GeometryRange( ) : arena( NULL ), baseVertex( 0 ), vertexCount( 0 ), firstIndex( 0 ), indexCount( 0 ) { }
+
+    GeometryRange( GeometryArena *arena, GLuint baseVertex, GLuint vertexCount, GLuint firstIndex, GLuint indexCount )
+        : arena( arena ), baseVertex( baseVertex ), vertexCount( vertexCount ), firstIndex( firstIndex ), indexCount( indexCount ) { }
+
+    GeometryRange( GeometryRange &&other ) : arena( NULL ), baseVertex( 0 ), vertexCount( 0 ), firstIndex( 0 ), indexCount( 0 )
+    {
+        this->swap( other );
+    }
+
+    GeometryRange &operator=( GeometryRange &&other )
+    {
+        this->swap( other );
+        return *this;
+    }
+
+    GeometryRange( const GeometryRange & ) = delete;
+    GeometryRange &operator=( const GeometryRange & ) = delete;
+
+    inline ~GeometryRange( );
+
+    DrawElementsIndirectCommand Command( GLuint instanceCount, GLuint baseInstance ) const
+    {
+        DrawElementsIndirectCommand command;
+        command.count = this->indexCount;
+        command.instanceCount = instanceCount;
+        command.firstIndex = this->firstIndex;
+        command.baseVertex = ( GLint )this->baseVertex;
+        command.baseInstance = baseInstance;
+        return command;
+    }
+
+    GeometryArena *Arena( ) const
+    {
+        return this->arena;
+    }
+
+private:
+    /*  Range Data  */
+    GeometryArena *arena;
+    GLuint baseVertex;
+    GLuint vertexCount;
+    GLuint firstIndex;
+    GLuint indexCount;
+
+    void swap( GeometryRange &other )
+    {
+        std::swap( this->arena, other.arena );
+        std::swap( this->baseVertex, other.baseVertex );
+        std::swap( this->vertexCount, other.vertexCount );
+        std::swap( this->firstIndex, other.firstIndex );
+        std::swap( this->indexCount, other.indexCount );
+    }
+};
+
+/*  One vertex buffer, index buffer and VAO shared by every mesh with the same vertex streams and index type.
+    Meshes are sub-allocated ranges drawn with a base vertex, so a model switches VAO once rather than once
+    per mesh and runs of meshes go out in a single multi-draw: glMultiDrawElementsIndirect when the context
+    is 4.3 or newer, glMultiDrawElementsBaseVertex on 3.3. The buffers double when full and are deleted when
+    the last range is freed, so the arenas hold no GL objects once every model is gone. */
+class GeometryArena
+{
+public:
+    /*  Functions  */
+    static GeometryArena &For( VertexStreamMask streams, GLenum indexType )
+    {
+        vector<unique_ptr<GeometryArena> > &arenas = all( );
+        for ( size_t i = 0; i < arenas.size( ); i++ )
+        {
+            if( arenas[i]->streams == streams && arenas[i]->indexType == indexType )
+            {
+                return *arenas[i];
+            }
+        }
+
+        arenas.push_back( unique_ptr<GeometryArena>( new GeometryArena( streams, indexType ) ) );
+        return *arenas.back( );
+    }
+
+    // Copies packed vertices (QuantizedVertexFormat::Layout( streams )) and their indices into the arena.
+    GeometryRange Allocate( const void *vertices, GLuint vertexCount, const void *indices, GLuint indexCount )
+    {
+        if( !this->vertexArray.Id( ) )
+        {
+            this->vertexArray = GLVertexArray::Create( );
+            this->indirectBuffer = GLBuffer::Create( );
+        }
+
+        GLuint baseVertex = 0, firstIndex = 0;
+        while( !this->vertices.Allocate( vertexCount, baseVertex ) )
+        {
+            this->growVertices( vertexCount );
+        }
+        while( !this->indices.Allocate( indexCount, firstIndex ) )
+        {
+            this->growIndices( indexCount );
+        }
+
+        // Uploads go through the copy target so neither the array binding nor any VAO's element binding moves
+        size_t indexSize = IndexArray::TypeSize( this->indexType );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, this->vertexBuffer );
+        glBufferSubData( GL_COPY_WRITE_BUFFER, ( GLintptr )baseVertex * this->stride, ( GLsizeiptr )vertexCount * this->stride, vertices );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, this->indexBuffer );
+        glBufferSubData( GL_COPY_WRITE_BUFFER, ( GLintptr )( firstIndex * indexSize ), ( GLsizeiptr )( indexCount * indexSize ), indices );
+
+        this->liveRanges++;
+        return GeometryRange( this, baseVertex, vertexCount, firstIndex, indexCount );
+    }
+
+    /*  Draws count commands (at most MAX_MULTI_DRAW) from this arena. The caller binds the material and
+        uniforms. With an instanceBuffer the commands read their model matrices from it (InstanceLayout);
+        on 3.3 every command in one call has to share the same baseInstance. */
+    void Draw( const DrawElementsIndirectCommand *commands, GLuint count, GLuint instanceBuffer )
+    {
+        GLState &state = GLState::Instance( );
+        state.BindVertexArray( this->vertexArray );
+
+        bool indirect = GLAD_GL_VERSION_4_3 != 0;
+        size_t indexSize = IndexArray::TypeSize( this->indexType );
+        if( instanceBuffer != 0 )
+        {
+            // Indirect commands carry their base instance, without them the attribute offset moves instead
+            state.BindBuffer( GL_ARRAY_BUFFER, instanceBuffer );
+            InstanceLayout::Apply( indirect ? 0 : commands[0].baseInstance );
+        }
+
+        if( count == 1 && instanceBuffer == 0 )
+        {
+            glDrawElementsBaseVertex( GL_TRIANGLES, ( GLsizei )commands[0].count, this->indexType,
+                                      ( GLvoid * )( commands[0].firstIndex * indexSize ), commands[0].baseVertex );
+        }
+        else if( indirect )
+        {
+            glBindBuffer( GL_DRAW_INDIRECT_BUFFER, this->indirectBuffer );
+            glBufferData( GL_DRAW_INDIRECT_BUFFER, count * sizeof( DrawElementsIndirectCommand ), commands, GL_STREAM_DRAW );
+            glMultiDrawElementsIndirect( GL_TRIANGLES, this->indexType, 0, ( GLsizei )count, 0 );
+        }
+        else if( instanceBuffer != 0 )
+        {
+            for ( GLuint i = 0; i < count; i++ )
+            {
+                glDrawElementsInstancedBaseVertex( GL_TRIANGLES, ( GLsizei )commands[i].count, this->indexType,
+                                                   ( GLvoid * )( commands[i].firstIndex * indexSize ),
+                                                   ( GLsizei )commands[i].instanceCount, commands[i].baseVertex );
+            }
+        }
+        else
+        {
+            GLsizei counts[MAX_MULTI_DRAW];
+            const GLvoid *offsets[MAX_MULTI_DRAW];
+            GLint baseVertices[MAX_MULTI_DRAW];
+            for ( GLuint i = 0; i < count; i++ )
+            {
+                counts[i] = ( GLsizei )commands[i].count;
+                offsets[i] = ( GLvoid * )( commands[i].firstIndex * indexSize );
+                baseVertices[i] = commands[i].baseVertex;
+            }
+            glMultiDrawElementsBaseVertex( GL_TRIANGLES, counts, this->indexType, offsets, ( GLsizei )count, baseVertices );
+        }
+    }
+
+    GLuint VertexArray( ) const
+    {
+        return this->vertexArray;
+    }
+
+    // Prints how full each arena is.
+    static void PrintReport( )
+    {
+        vector<unique_ptr<GeometryArena> > &arenas = all( );
+        for ( size_t i = 0; i < arenas.size( ); i++ )
+        {
+            const GeometryArena &arena = *arenas[i];
+            GLuint usedVertices = arena.vertices.Capacity( ) - arena.vertices.FreeCount( );
+            GLuint usedIndices = arena.indices.Capacity( ) - arena.indices.FreeCount( );
+            printf( "ARENA:: streams 0x%x %2u-bit indices  %4u ranges  vertices %8u / %8u  indices %9u / %9u  gpu %8.2f MB\n",
+                    arena.streams, ( GLuint )IndexArray::TypeSize( arena.indexType ) * 8, arena.liveRanges, usedVertices,
+                    arena.vertices.Capacity( ), usedIndices, arena.indices.Capacity( ),
+                    ( ( double )arena.vertices.Capacity( ) * arena.stride + ( double )arena.indices.Capacity( ) *
+                      IndexArray::TypeSize( arena.indexType ) ) / ( 1024.0 * 1024.0 ) );
+        }
+    }
+
+private:
+    friend class GeometryRange;
+
+    // Smallest buffers an arena starts with, in vertices and indices
+    static const GLuint MIN_VERTICES = 1 << 16;
+    static const GLuint MIN_INDICES = 3 << 16;
+
+    /*  Arena Data  */
+    VertexStreamMask streams;
+    GLenum indexType;
+    GLsizei stride;
+    GLVertexArray vertexArray;
+    GLBuffer vertexBuffer;
+    GLBuffer indexBuffer;
+    GLBuffer indirectBuffer;
+    RangeAllocator vertices;
+    RangeAllocator indices;
+    GLuint liveRanges;
+
+    GeometryArena( VertexStreamMask streams, GLenum indexType )
+        : streams( streams ), indexType( indexType ), liveRanges( 0 )
+    {
+        this->stride = QuantizedVertexFormat::Layout( streams ).stride;
+    }
+
+    static vector<unique_ptr<GeometryArena> > &all( )
+    {
+        static vector<unique_ptr<GeometryArena> > arenas;
+        return arenas;
+    }
+
+    /*  Functions   */
+    void release( GLuint baseVertex, GLuint vertexCount, GLuint firstIndex, GLuint indexCount )
+    {
+        this->vertices.Free( baseVertex, vertexCount );
+        this->indices.Free( firstIndex, indexCount );
+
+        if( --this->liveRanges == 0 )
+        {
+            this->vertexArray.Reset( );
+            this->vertexBuffer.Reset( );
+            this->indexBuffer.Reset( );
+            this->indirectBuffer.Reset( );
+            this->vertices.Reset( );
+            this->indices.Reset( );
+        }
+    }
+
+    // Replaces buffer with one of newBytes holding its first usedBytes
+    static void grow( GLBuffer &buffer, size_t usedBytes, size_t newBytes )
+    {
+        GLBuffer grown = GLBuffer::Create( );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, grown );
+        glBufferData( GL_COPY_WRITE_BUFFER, ( GLsizeiptr )newBytes, NULL, GL_STATIC_DRAW );
+        if( usedBytes > 0 )
+        {
+            glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+            glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, ( GLsizeiptr )usedBytes );
+        }
+        buffer = std::move( grown );
+    }
+
+    void growVertices( GLuint needed )
+    {
+        GLuint capacity = this->vertices.Capacity( );
+        GLuint newCapacity = max( max( capacity * 2, capacity + needed ), GLuint( MIN_VERTICES ) );
+        grow( this->vertexBuffer, ( size_t )capacity * this->stride, ( size_t )newCapacity * this->stride );
+        this->vertices.Grow( newCapacity );
+
+        // Point the VAO at the new store
+        GLState::Instance( ).BindVertexArray( this->vertexArray );
+        GLState::Instance( ).BindBuffer( GL_ARRAY_BUFFER, this->vertexBuffer );
+        QuantizedVertexFormat::Layout( this->streams ).Apply( );
+    }
+
+    void growIndices( GLuint needed )
+    {
+        GLuint capacity = this->indices.Capacity( );
+        GLuint newCapacity = max( max( capacity * 2, capacity + needed ), GLuint( MIN_INDICES ) );
+        size_t indexSize = IndexArray::TypeSize( this->indexType );
+        grow( this->indexBuffer, capacity * indexSize, newCapacity * indexSize );
+        this->indices.Grow( newCapacity );
+
+        GLState::Instance( ).BindVertexArray( this->vertexArray );
+        GLState::Instance( ).BindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer );
+    }
+};
+
+inline GeometryRange::~GeometryRange( )
+{
+    if( this->arena )
+    {
+        this->arena->release( this->baseVertex, this->vertexCount, this->firstIndex, this->indexCount );
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+
+// How each kind of GL object is created and deleted.
+struct GLBufferTraits
+{
+    static GLuint Create( )
+    {
+        GLuint id = 0;
+        glGenBuffers( 1, &id );
+        return id;
+    }
+
+    static void Destroy( GLuint id )
+    {
+        GLState::Instance( ).BufferDeleted( id );
+        glDeleteBuffers( 1, &id );
+    }
+};
+
+struct GLVertexArrayTraits
+{
+    static GLuint Create( )
+    {
+        GLuint id = 0;
+        glGenVertexArrays( 1, &id );
+        return id;
+    }
+
+    static void Destroy( GLuint id )
+    {
+        GLState::Instance( ).VertexArrayDeleted( id );
+        glDeleteVertexArrays( 1, &id );
+    }
+};
+
+struct GLTextureTraits
+{
+    static GLuint Create( )
+    {
+        GLuint id = 0;
+        glGenTextures( 1, &id );
+        return id;
+    }
+
+    static void Destroy( GLuint id )
+    {
+        GLState::Instance( ).TextureDeleted( id );
+        glDeleteTextures( 1, &id );
+    }
+};
+
+struct GLProgramTraits
+{
+    static GLuint Create( )
+    {
+        return glCreateProgram( );
+    }
+
+    static void Destroy( GLuint id )
+    {
+        GLState::Instance( ).ProgramDeleted( id );
+        glDeleteProgram( id );
+    }
+};
+
+/*  Move-only owner of a single GL object name, deleted when the owner goes away. Converts to the raw
+    name so it can be handed straight to gl* calls. Owners must be destroyed while the context is
+    still current, i.e. before glfwTerminate. */
+template <class Traits>
+class GLObject
+{
+public:
+    /*  Functions  */
+    GLObject( ) : id( 0 ) { }
+
+    // Takes ownership of an existing name
+    explicit GLObject( GLuint id ) : id( id ) { }
+
+    GLObject( GLObject &&other ) : id( other.id )
+    {
+        other.id = 0;
+    }
+
+    GLObject &operator=( GLObject &&other )
+    {
+        std::swap( this->id, other.id );
+        return *this;
+    }
+
+    GLObject( const GLObject & ) = delete;
+    GLObject &operator=( const GLObject & ) = delete;
+
+    ~GLObject( )
+    {
+        this->Reset( );
+    }
+
+    // Generates a fresh object
+    static GLObject Create( )
+    {
+        return GLObject( Traits::Create( ) );
+    }
+
+    // Deletes the owned object, if any, and takes ownership of id instead
+    void Reset( GLuint id = 0 )
+    {
+        if( this->id != 0 )
+        {
+            Traits::Destroy( this->id );
+        }
+        this->id = id;
+    }
+
+    GLuint Id( ) const
+    {
+        return this->id;
+    }
+
+    operator GLuint( ) const
+    {
+        return this->id;
+    }
+
+private:
+    GLuint id;
+};
+
+typedef GLObject<GLBufferTraits> GLBuffer;
+typedef GLObject<GLVertexArrayTraits> GLVertexArray;
+typedef GLObject<GLTextureTraits> GLTexture;
+typedef GLObject<GLProgramTraits> GLProgram;
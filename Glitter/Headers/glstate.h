@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstdio>
+
+#include <glad/glad.h>
+
+using namespace std;
+
+// GL calls that went to the driver and calls dropped because they wouldn't have changed anything.
+struct GLStateStats
+{
+    GLuint issued;
+    GLuint elided;
+};
+
+/*  Shadow copy of the binding state the engine touches: program, VAO, array/uniform buffers, the
+    2D and cube map texture on each unit, and the depth function. Each call mirrors its gl* namesake
+    and is only forwarded when it changes something. All code that changes these bindings has to go
+    through here, or call Invalidate( ) afterwards. GLObject tells the cache about deletions so a
+    recycled name is never mistaken for the old binding. */
+class GLState
+{
+public:
+    // Never a valid name or enum, used for "not known"
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    /*  Functions  */
+    static GLState &Instance( )
+    {
+        static GLState state;
+        return state;
+    }
+
+    void UseProgram( GLuint program )
+    {
+        if( this->record( this->program == program ) )
+        {
+            this->program = program;
+            glUseProgram( program );
+        }
+    }
+
+    void BindVertexArray( GLuint vertexArray )
+    {
+        if( this->record( this->vertexArray == vertexArray ) )
+        {
+            this->vertexArray = vertexArray;
+            glBindVertexArray( vertexArray );
+        }
+    }
+
+    // GL_ELEMENT_ARRAY_BUFFER belongs to the bound VAO, so it is always forwarded
+    void BindBuffer( GLenum target, GLuint buffer )
+    {
+        GLuint *cached = this->bufferSlot( target );
+        if( this->record( cached && *cached == buffer ) )
+        {
+            if( cached )
+            {
+                *cached = buffer;
+            }
+            glBindBuffer( target, buffer );
+        }
+    }
+
+    // Indexed binding points are not tracked, but GL also moves the generic binding
+    void BindBufferBase( GLenum target, GLuint index, GLuint buffer )
+    {
+        GLuint *cached = this->bufferSlot( target );
+        if( cached )
+        {
+            *cached = buffer;
+        }
+        this->record( false );
+        glBindBufferBase( target, index, buffer );
+    }
+
+    // unit is GL_TEXTURE0 + n like glActiveTexture takes
+    void ActiveTexture( GLenum unit )
+    {
+        GLuint index = unit - GL_TEXTURE0;
+        if( this->record( this->activeUnit == index ) )
+        {
+            this->activeUnit = index;
+            glActiveTexture( unit );
+        }
+    }
+
+    // Binds on the active unit. Only GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP are tracked.
+    void BindTexture( GLenum target, GLuint texture )
+    {
+        GLuint *cached = this->textureSlot( this->activeUnit, target );
+        if( this->record( cached && *cached == texture ) )
+        {
+            if( cached )
+            {
+                *cached = texture;
+            }
+            glBindTexture( target, texture );
+        }
+    }
+
+    void DepthFunc( GLenum func )
+    {
+        if( this->record( this->depthFunc == func ) )
+        {
+            this->depthFunc = func;
+            glDepthFunc( func );
+        }
+    }
+
+    // The program in use, UNKNOWN after Invalidate( ) until the next UseProgram
+    GLuint Program( ) const
+    {
+        return this->program;
+    }
+
+    /*  Deletion notifications. GL drops bindings to deleted objects, except for the current program
+        which stays in use until replaced, so that one becomes unknown.  */
+    void ProgramDeleted( GLuint program )
+    {
+        if( this->program == program )
+        {
+            this->program = UNKNOWN;
+        }
+    }
+
+    void VertexArrayDeleted( GLuint vertexArray )
+    {
+        if( this->vertexArray == vertexArray )
+        {
+            this->vertexArray = 0;
+        }
+    }
+
+    void BufferDeleted( GLuint buffer )
+    {
+        for ( GLuint i = 0; i < BUFFER_TARGETS; i++ )
+        {
+            if( this->buffers[i] == buffer )
+            {
+                this->buffers[i] = 0;
+            }
+        }
+    }
+
+    void TextureDeleted( GLuint texture )
+    {
+        for ( GLuint unit = 0; unit < MAX_TRACKED_UNITS; unit++ )
+        {
+            for ( GLuint i = 0; i < TEXTURE_TARGETS; i++ )
+            {
+                if( this->textures[unit][i] == texture )
+                {
+                    this->textures[unit][i] = 0;
+                }
+            }
+        }
+    }
+
+    // Forgets everything, the next call of each kind is always forwarded.
+    void Invalidate( )
+    {
+        this->program = UNKNOWN;
+        this->vertexArray = UNKNOWN;
+        this->activeUnit = UNKNOWN;
+        this->depthFunc = UNKNOWN;
+        for ( GLuint i = 0; i < BUFFER_TARGETS; i++ )
+        {
+            this->buffers[i] = UNKNOWN;
+        }
+        for ( GLuint unit = 0; unit < MAX_TRACKED_UNITS; unit++ )
+        {
+            for ( GLuint i = 0; i < TEXTURE_TARGETS; i++ )
+            {
+                this->textures[unit][i] = UNKNOWN;
+            }
+        }
+    }
+
+    // Starts counting a new frame, the finished one is kept for LastFrame( ).
+    void BeginFrame( )
+    {
+        this->lastFrame = this->frame;
+        this->frame.issued = 0;
+        this->frame.elided = 0;
+    }
+
+    const GLStateStats &LastFrame( ) const
+    {
+        return this->lastFrame;
+    }
+
+    void PrintReport( ) const
+    {
+        GLuint total = this->lastFrame.issued + this->lastFrame.elided;
+        printf( "GLSTATE:: last frame %u state calls, %u issued, %u elided (%.1f%%)\n", total, this->lastFrame.issued,
+                this->lastFrame.elided, total ? 100.0 * this->lastFrame.elided / total : 0.0 );
+    }
+
+private:
+    static const GLuint MAX_TRACKED_UNITS = 16;
+    static const GLuint TEXTURE_TARGETS = 2;
+    static const GLuint BUFFER_TARGETS = 2;
+
+    /*  State Data  */
+    GLuint program;
+    GLuint vertexArray;
+    GLuint buffers[BUFFER_TARGETS];
+    GLuint activeUnit;
+    GLuint textures[MAX_TRACKED_UNITS][TEXTURE_TARGETS];
+    GLenum depthFunc;
+    GLStateStats frame;
+    GLStateStats lastFrame;
+
+    GLState( )
+    {
+        this->Invalidate( );
+        this->frame.issued = this->frame.elided = 0;
+        this->lastFrame = this->frame;
+    }
+
+    GLState( const GLState & );
+    GLState &operator=( const GLState & );
+
+    // Counts the call and returns whether it has to be forwarded
+    bool record( bool redundant )
+    {
+        if( redundant )
+        {
+            this->frame.elided++;
+            return false;
+        }
+        this->frame.issued++;
+        return true;
+    }
+
+    GLuint *bufferSlot( GLenum target )
+    {
+        switch( target )
+        {
+        case GL_ARRAY_BUFFER:
+            return &this->buffers[0];
+        case GL_UNIFORM_BUFFER:
+            return &this->buffers[1];
+        default:
+            return NULL;
+        }
+    }
+
+    GLuint *textureSlot( GLuint unit, GLenum target )
+    {
+        if( unit >= MAX_TRACKED_UNITS )
+        {
+            return NULL;
+        }
+        switch( target )
+        {
+        case GL_TEXTURE_2D:
+            return &this->textures[unit][0];
+        case GL_TEXTURE_CUBE_MAP:
+            return &this->textures[unit][1];
+        default:
+            return NULL;
+        }
+    }
+};
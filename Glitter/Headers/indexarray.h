@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+
+using namespace std;
+
+// Triangle indices kept at the narrowest width that can address the mesh, on the CPU and in the element buffer.
+// Meshes with up to 65536 vertices use GL_UNSIGNED_SHORT, anything bigger falls back to GL_UNSIGNED_INT.
+// GL_UNSIGNED_BYTE is never picked: many drivers convert byte indices on the CPU at draw time.
+class IndexArray
+{
+public:
+    /*  Functions  */
+    IndexArray( ) : type( GL_UNSIGNED_SHORT ) { }
+
+    // Narrows indices into a mesh of vertexCount vertices.
+    IndexArray( const vector<GLuint> &indices, size_t vertexCount )
+    {
+        this->type = NarrowestType( vertexCount );
+        if( this->type == GL_UNSIGNED_SHORT )
+        {
+            this->shortIndices.assign( indices.begin( ), indices.end( ) );
+        }
+        else
+        {
+            this->intIndices = indices;
+        }
+    }
+
+    // Copies count indices that are already stored as type, e.g. from the mesh cache.
+    IndexArray( const void *data, size_t count, GLenum type ) : type( type )
+    {
+        if( type == GL_UNSIGNED_SHORT )
+        {
+            this->shortIndices.resize( count );
+            memcpy( this->shortIndices.data( ), data, count * sizeof( GLushort ) );
+        }
+        else
+        {
+            this->intIndices.resize( count );
+            memcpy( this->intIndices.data( ), data, count * sizeof( GLuint ) );
+        }
+    }
+
+    static GLenum NarrowestType( size_t vertexCount )
+    {
+        return vertexCount <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    static size_t TypeSize( GLenum type )
+    {
+        return type == GL_UNSIGNED_SHORT ? sizeof( GLushort ) : sizeof( GLuint );
+    }
+
+    GLuint operator[]( size_t i ) const
+    {
+        return this->type == GL_UNSIGNED_SHORT ? this->shortIndices[i] : this->intIndices[i];
+    }
+
+    size_t Size( ) const
+    {
+        return this->type == GL_UNSIGNED_SHORT ? this->shortIndices.size( ) : this->intIndices.size( );
+    }
+
+    // GL type to pass to glDrawElements
+    GLenum Type( ) const
+    {
+        return this->type;
+    }
+
+    const void *Data( ) const
+    {
+        return this->type == GL_UNSIGNED_SHORT ? ( const void * )this->shortIndices.data( ) : ( const void * )this->intIndices.data( );
+    }
+
+    size_t Bytes( ) const
+    {
+        return this->Size( ) * TypeSize( this->type );
+    }
+
+private:
+    /*  Index Data  */
+    GLenum type;
+    // Only the vector matching type is used
+    vector<GLushort> shortIndices;
+    vector<GLuint> intIndices;
+};
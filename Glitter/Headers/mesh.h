@@ -1,15 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
 #include <vector>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "geometryarena.h"
+#include "indexarray.h"
+#include "shader.h"
+#include "textureregistry.h"
+#include "vertexformat.h"
+
 using namespace std;
 
 struct Vertex
@@ -22,116 +32,343 @@ struct Vertex
     glm::vec2 TexCoords;
 };
 
+// Detail levels a mesh can have, the full mesh included.
+const GLuint MAX_LOD_LEVELS = 4;
+
+// A coarser level of a mesh: indices [firstIndex, firstIndex + indexCount) of its lodIndices, over the same
+// vertices. error is how far, in object units, the level can be from the full mesh's surface.
+struct MeshLod
+{
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLfloat error;
+};
+
+// A material texture slot: an owned reference into the TextureRegistry plus its type, four bytes per slot.
 struct Texture
 {
-    GLuint id;
-    string type;
-    aiString path;
+    TextureRef handle;
+    TextureType type;
+};
+
+// A mesh's material resolved against one shader: which GL texture goes on which unit, plus the constant
+// parameters. Only textures the shader actually samples are listed.
+struct MaterialBinding
+{
+    GLuint program;
+    GLuint textureCount;
+    GLubyte units[TEXTURE_TYPE_COUNT * MAX_MATERIAL_SAMPLERS];
+    GLuint textures[TEXTURE_TYPE_COUNT * MAX_MATERIAL_SAMPLERS];
+    GLfloat shininess;
 };
 
 class Mesh
 {
 public:
     /*  Mesh Data  */
+    // CPU copies of the geometry, empty for meshes uploaded from the mesh cache until Model::RequireCpuGeometry
     vector<Vertex> vertices;
-    vector<GLuint> indices;
+    IndexArray indices;
+    // Coarser levels over the same vertices, level i + 1 is lods[i] in lodIndices
+    IndexArray lodIndices;
+    vector<MeshLod> lods;
     vector<Texture> textures;
+    // Object space bounds of the vertices, a box and the sphere around the box centre that holds them all
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    GLfloat boundsRadius;
     
     /*  Functions  */
-    // Constructor
-    Mesh( vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures )
+    // Constructor, takes over the arrays; streams selects which attributes are uploaded (see Shader::ActiveStreams).
+    // Nothing reaches the GPU until Upload, the owning model decides the quantization bounds.
+    Mesh( vector<Vertex> &&vertices, IndexArray &&indices, vector<Texture> &&textures, glm::vec3 boundsMin, glm::vec3 boundsMax,
+          GLfloat boundsRadius, VertexStreamMask streams = STREAM_ALL )
+        : vertices( std::move( vertices ) ), indices( std::move( indices ) ), textures( std::move( textures ) ),
+          boundsMin( boundsMin ), boundsMax( boundsMax ), boundsRadius( boundsRadius ), streams( streams ), vertexStride( 0 )
+    {
+        this->vertexCount = ( GLuint )this->vertices.size( );
+        this->indexCount = ( GLuint )this->indices.Size( );
+        this->lodIndexCount = 0;
+        this->indexType = this->indices.Type( );
+    }
+    
+    // Constructor for a mesh that keeps no arrays: only their sizes, the data is handed to Upload by the caller.
+    Mesh( GLuint vertexCount, GLuint indexCount, GLuint lodIndexCount, GLenum indexType, vector<MeshLod> &&lods,
+          vector<Texture> &&textures, glm::vec3 boundsMin, glm::vec3 boundsMax, GLfloat boundsRadius, VertexStreamMask streams )
+        : lods( std::move( lods ) ), textures( std::move( textures ) ), boundsMin( boundsMin ), boundsMax( boundsMax ),
+          boundsRadius( boundsRadius ), vertexCount( vertexCount ), indexCount( indexCount ), lodIndexCount( lodIndexCount ),
+          indexType( indexType ), streams( streams ), vertexStride( 0 )
+    {
+    }
+    
+    // Hands over the coarser levels, before Upload. They share the vertex buffer and sit right after the full
+    // mesh's indices in the element buffer.
+    void SetLods( IndexArray &&lodIndices, vector<MeshLod> &&lods )
+    {
+        this->lodIndices = std::move( lodIndices );
+        this->lods = std::move( lods );
+        this->lodIndexCount = ( GLuint )this->lodIndices.Size( );
+    }
+    
+    // Packs the vertices against bounds, which must contain them, and copies them into the arena for their format.
+    void Upload( const QuantizationBounds &bounds )
+    {
+        this->quantization = bounds;
+        this->upload( this->vertices.data( ), NULL, NULL );
+    }
+    
+    // Uploads from memory the caller owns, the mapped mesh cache. packed holds the vertices already packed against
+    // bounds in the layout for Streams( ), or is null to pack vertices here; indices are every level's, the full
+    // mesh first.
+    void Upload( const QuantizationBounds &bounds, const Vertex *vertices, const void *packed, const void *indices )
+    {
+        this->quantization = bounds;
+        this->upload( vertices, packed, indices );
+    }
+    
+    // Hands over CPU copies of the geometry for a mesh built without them, they must match what was uploaded.
+    void SetCpuGeometry( vector<Vertex> &&vertices, IndexArray &&indices, IndexArray &&lodIndices )
+    {
+        this->vertices = std::move( vertices );
+        this->indices = std::move( indices );
+        this->lodIndices = std::move( lodIndices );
+    }
+    
+    // Frees the CPU copies once the geometry is on the GPU and can be read back from elsewhere.
+    void ReleaseCpuGeometry( )
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        vector<Vertex>( ).swap( this->vertices );
+        this->indices = IndexArray( );
+        this->lodIndices = IndexArray( );
+    }
+    
+    // The arena range and texture references are owned, so meshes move but never copy
+    Mesh( Mesh && ) = default;
+    Mesh &operator=( Mesh && ) = default;
+    Mesh( const Mesh & ) = delete;
+    Mesh &operator=( const Mesh & ) = delete;
+    
+    // Re-packs the vertex buffer if a shader needs a different set of attributes. vertices and indices are as for
+    // Upload, null to use the mesh's own arrays.
+    void SetStreams( VertexStreamMask streams, const Vertex *vertices = NULL, const void *indices = NULL )
+    {
+        if( streams == this->streams )
+        {
+            return;
+        }
         
-        // Now that we have all the required data, set the vertex buffers and its attribute pointers.
-        this->setupMesh( );
+        // A different format lives in a different arena, the old range is freed once the new one is in
+        this->streams = streams;
+        this->upload( vertices ? vertices : this->vertices.data( ), NULL, indices );
+    }
+    
+    VertexStreamMask Streams( ) const
+    {
+        return this->streams;
+    }
+    
+    // Resolves the material for shader ahead of time, so the first frame drawn with it doesn't have to.
+    void BakeMaterial( const Shader &shader )
+    {
+        this->material( shader );
+    }
+    
+    // Sort key fields for the Renderer: the arena's VAO and the first texture of the material resolved for shader.
+    GLuint VertexArray( ) const
+    {
+        return this->geometry.Arena( )->VertexArray( );
     }
     
-    // Render the mesh
-    void Draw( Shader shader )
+    GLuint MaterialKey( const Shader &shader ) const
     {
-        // Bind appropriate textures
-        GLuint diffuseNr = 1;
-        GLuint specularNr = 1;
+        const MaterialBinding &material = this->material( shader );
+        return material.textureCount > 0 ? material.textures[0] : 0;
+    }
+    
+    // Whether other can go out in the same multi-draw as this mesh: same arena, quantization and material.
+    bool CanBatchWith( const Mesh &other, const Shader &shader ) const
+    {
+        if( this->geometry.Arena( ) != other.geometry.Arena( ) || !( this->quantization == other.quantization ) )
+        {
+            return false;
+        }
         
-        for( GLuint i = 0; i < this->textures.size( ); i++ )
+        const MaterialBinding &a = this->material( shader ), &b = other.material( shader );
+        if( a.textureCount != b.textureCount || a.shininess != b.shininess )
         {
-            glActiveTexture( GL_TEXTURE0 + i ); // Active proper texture unit before binding
-            // Retrieve texture number (the N in diffuse_textureN)
-            stringstream ss;
-            string number;
-            string name = this->textures[i].type;
-            
-            if( name == "texture_diffuse" )
-            {
-                ss << diffuseNr++; // Transfer GLuint to stream
-            }
-            else if( name == "texture_specular" )
+            return false;
+        }
+        for ( GLuint i = 0; i < a.textureCount; i++ )
+        {
+            if( a.units[i] != b.units[i] || a.textures[i] != b.textures[i] )
             {
-                ss << specularNr++; // Transfer GLuint to stream
+                return false;
             }
-            
-            number = ss.str( );
-            // Now set the sampler to the correct texture unit
-            glUniform1i( glGetUniformLocation( shader.Program, ( name + number ).c_str( ) ), i );
-            // And finally bind the texture
-            glBindTexture( GL_TEXTURE_2D, this->textures[i].id );
+        }
+        return true;
+    }
+    
+    // Where this mesh sits in its arena, for GeometryArena::Draw. Levels past the coarsest draw the coarsest.
+    DrawElementsIndirectCommand Command( GLuint instanceCount, GLuint baseInstance, GLuint lod = 0 ) const
+    {
+        DrawElementsIndirectCommand command = this->geometry.Command( instanceCount, baseInstance );
+        if( lod == 0 || this->lods.empty( ) )
+        {
+            command.count = this->indexCount;
+            return command;
         }
         
-        // Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
-        glUniform1f( glGetUniformLocation( shader.Program, "material.shininess" ), 16.0f );
-        
-        // Draw mesh
-        glBindVertexArray( this->VAO );
-        glDrawElements( GL_TRIANGLES, this->indices.size( ), GL_UNSIGNED_INT, 0 );
-        glBindVertexArray( 0 );
-        
-        // Always good practice to set everything back to defaults once configured.
-        for ( GLuint i = 0; i < this->textures.size( ); i++ )
+        const MeshLod &level = this->lods[std::min( lod, ( GLuint )this->lods.size( ) ) - 1];
+        command.firstIndex += this->indexCount + level.firstIndex;
+        command.count = level.indexCount;
+        return command;
+    }
+    
+    // Detail levels including the full mesh.
+    GLuint LodCount( ) const
+    {
+        return ( GLuint )this->lods.size( ) + 1;
+    }
+    
+    GLuint TriangleCount( GLuint lod = 0 ) const
+    {
+        return this->Command( 0, 0, lod ).count / 3;
+    }
+    
+    // How far level lod strays from the full mesh, in object units.
+    GLfloat LodError( GLuint lod ) const
+    {
+        return lod == 0 || this->lods.empty( ) ? 0.0f : this->lods[std::min( lod, ( GLuint )this->lods.size( ) ) - 1].error;
+    }
+    
+    GeometryArena &Arena( ) const
+    {
+        return *this->geometry.Arena( );
+    }
+    
+    // Makes the material and the dequantization uniforms current for a draw with shader.
+    void Bind( Shader &shader ) const
+    {
+        // Bind the pre-resolved textures, the samplers were pointed at their units when the shader linked
+        GLState &state = GLState::Instance( );
+        const MaterialBinding &material = this->material( shader );
+        for ( GLuint i = 0; i < material.textureCount; i++ )
         {
-            glActiveTexture( GL_TEXTURE0 + i );
-            glBindTexture( GL_TEXTURE_2D, 0 );
+            state.ActiveTexture( GL_TEXTURE0 + material.units[i] );
+            state.BindTexture( GL_TEXTURE_2D, material.textures[i] );
         }
+        shader.Set( shader.Standard( UNIFORM_MATERIAL_SHININESS ), material.shininess );
+        
+        // Undo the vertex quantization in the vertex shader
+        shader.Set( shader.Standard( UNIFORM_POSITION_SCALE ), this->dequantization.positionScale );
+        shader.Set( shader.Standard( UNIFORM_POSITION_OFFSET ), this->dequantization.positionOffset );
+        shader.Set( shader.Standard( UNIFORM_TEXCOORD_TRANSFORM ), this->dequantization.texCoordTransform );
+    }
+    
+    // Render the mesh on its own. Runs every frame, so it must not touch the heap or look anything up by name.
+    void Draw( Shader &shader ) const
+    {
+        this->Bind( shader );
+        DrawElementsIndirectCommand command = this->Command( 1, 0 );
+        this->Arena( ).Draw( &command, 1, 0 );
+    }
+    
+    // Bytes held in system memory by the vertex, index and texture slot arrays.
+    size_t CpuBytes( ) const
+    {
+        return this->vertices.size( ) * sizeof( Vertex ) + this->indices.Bytes( ) + this->lodIndices.Bytes( ) +
+               this->lods.size( ) * sizeof( MeshLod ) + this->textures.size( ) * sizeof( Texture );
+    }
+    
+    // Bytes uploaded to the vertex and element buffers.
+    size_t GpuBytes( ) const
+    {
+        return this->vertexCount * this->vertexStride + ( this->indexCount + this->lodIndexCount ) * IndexArray::TypeSize( this->indexType );
     }
     
 private:
     /*  Render data  */
-    GLuint VAO, VBO, EBO;
+    GLuint vertexCount;
+    GLuint indexCount;
+    GLuint lodIndexCount;
+    GLenum indexType;
+    GeometryRange geometry;
+    VertexStreamMask streams;
+    GLsizei vertexStride;
+    QuantizationBounds quantization;
+    VertexDequantization dequantization;
+    // One entry per shader that has drawn this mesh, filled on first use
+    mutable vector<MaterialBinding> materials;
     
     /*  Functions    */
-    // Initializes all the buffer objects/arrays
-    void setupMesh( )
+    // Returns the binding table for shader, building it the first time that shader is seen.
+    const MaterialBinding &material( const Shader &shader ) const
     {
-        // Create buffers/arrays
-        glGenVertexArrays( 1, &this->VAO );
-        glGenBuffers( 1, &this->VBO );
-        glGenBuffers( 1, &this->EBO );
+        for ( GLuint i = 0; i < this->materials.size( ); i++ )
+        {
+            if( this->materials[i].program == shader.Program )
+            {
+                return this->materials[i];
+            }
+        }
+        
+        MaterialBinding material;
+        material.program = shader.Program;
+        material.textureCount = 0;
+        // Every mesh uses the same default (if you want you could extend this to another mesh property and possibly change this value)
+        material.shininess = 16.0f;
         
-        glBindVertexArray( this->VAO );
-        // Load data into vertex buffers
-        glBindBuffer( GL_ARRAY_BUFFER, this->VBO );
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData( GL_ARRAY_BUFFER, this->vertices.size( ) * sizeof( Vertex ), &this->vertices[0], GL_STATIC_DRAW );
+        // Textures are numbered per type in material order, the N in texture_diffuseN
+        GLuint numbers[TEXTURE_TYPE_COUNT] = { 0 };
+        for ( GLuint i = 0; i < this->textures.size( ); i++ )
+        {
+            TextureType type = this->textures[i].type;
+            GLuint number = ++numbers[type];
+            if( shader.Sampler( type, number ) == INVALID_UNIFORM )
+            {
+                continue;
+            }
+            material.units[material.textureCount] = ( GLubyte )Shader::MaterialUnit( type, number );
+            material.textures[material.textureCount] = TextureRegistry::Instance( ).Id( this->textures[i].handle );
+            material.textureCount++;
+        }
         
-        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->EBO );
-        glBufferData( GL_ELEMENT_ARRAY_BUFFER, this->indices.size( ) * sizeof( GLuint ), &this->indices[0], GL_STATIC_DRAW );
+        this->materials.push_back( material );
+        return this->materials.back( );
+    }
+
+    // Moves the mesh into the arena for its streams, packing vertices first unless packed already holds them.
+    // A null indices takes the mesh's own arrays.
+    void upload( const Vertex *vertices, const void *packed, const void *indices )
+    {
+        vector<unsigned char> packing;
+        if( packed )
+        {
+            this->dequantization = QuantizedVertexFormat::Dequantization( this->quantization );
+        }
+        else
+        {
+            this->dequantization = QuantizedVertexFormat::Pack( vertices, this->vertexCount, this->streams, this->quantization, packing );
+            packed = packing.data( );
+        }
+        this->vertexStride = QuantizedVertexFormat::Layout( this->streams ).stride;
         
-        // Set the vertex attribute pointers
-        // Vertex Positions
-        glEnableVertexAttribArray( 0 );
-        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )0 );
-        // Vertex Normals
-        glEnableVertexAttribArray( 1 );
-        glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, Normal ) );
-        // Vertex Texture Coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, TexCoords ) );
+        // One index range for every level, the full mesh first
+        vector<unsigned char> levels;
+        if( !indices && this->lods.empty( ) )
+        {
+            indices = this->indices.Data( );
+        }
+        else if( !indices )
+        {
+            levels.resize( this->indices.Bytes( ) + this->lodIndices.Bytes( ) );
+            memcpy( levels.data( ), this->indices.Data( ), this->indices.Bytes( ) );
+            memcpy( levels.data( ) + this->indices.Bytes( ), this->lodIndices.Data( ), this->lodIndices.Bytes( ) );
+            indices = levels.data( );
+        }
         
-        glBindVertexArray( 0 );
+        GeometryArena &arena = GeometryArena::For( this->streams, this->indexType );
+        this->geometry = arena.Allocate( packed, this->vertexCount, indices, this->indexCount + this->lodIndexCount );
     }
 };
 
@@ -0,0 +1,635 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <map>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mesh.h"
+
+using namespace std;
+
+// Bump whenever the on-disk layout or the import pipeline feeding it changes, stale caches are then rebuilt.
+const uint32_t MESH_CACHE_VERSION = 7;
+const char MESH_CACHE_MAGIC[4] = { 'G', 'L', 'M', 'C' };
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile( ) : data( nullptr ), size( 0 )
+    {
+#ifdef _WIN32
+        this->file = INVALID_HANDLE_VALUE;
+        this->mapping = NULL;
+#endif
+    }
+
+    ~MappedFile( )
+    {
+        this->Close( );
+    }
+
+    bool Open( const string &path )
+    {
+        this->Close( );
+#ifdef _WIN32
+        this->file = CreateFileA( path.c_str( ), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+        if( this->file == INVALID_HANDLE_VALUE )
+        {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if( !GetFileSizeEx( this->file, &fileSize ) || fileSize.QuadPart == 0 )
+        {
+            this->Close( );
+            return false;
+        }
+        this->mapping = CreateFileMappingA( this->file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if( this->mapping == NULL )
+        {
+            this->Close( );
+            return false;
+        }
+        this->data = ( const unsigned char * )MapViewOfFile( this->mapping, FILE_MAP_READ, 0, 0, 0 );
+        this->size = ( size_t )fileSize.QuadPart;
+#else
+        int fd = open( path.c_str( ), O_RDONLY );
+        if( fd < 0 )
+        {
+            return false;
+        }
+        struct stat info;
+        if( fstat( fd, &info ) != 0 || info.st_size == 0 )
+        {
+            close( fd );
+            return false;
+        }
+        void *view = mmap( nullptr, ( size_t )info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd ); // The mapping keeps its own reference to the file
+        if( view == MAP_FAILED )
+        {
+            return false;
+        }
+        this->data = ( const unsigned char * )view;
+        this->size = ( size_t )info.st_size;
+#endif
+        if( !this->data )
+        {
+            this->Close( );
+            return false;
+        }
+        return true;
+    }
+
+    void Close( )
+    {
+#ifdef _WIN32
+        if( this->data )
+        {
+            UnmapViewOfFile( this->data );
+        }
+        if( this->mapping != NULL )
+        {
+            CloseHandle( this->mapping );
+            this->mapping = NULL;
+        }
+        if( this->file != INVALID_HANDLE_VALUE )
+        {
+            CloseHandle( this->file );
+            this->file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if( this->data )
+        {
+            munmap( ( void * )this->data, this->size );
+        }
+#endif
+        this->data = nullptr;
+        this->size = 0;
+    }
+
+    const unsigned char *Data( ) const
+    {
+        return this->data;
+    }
+
+    size_t Size( ) const
+    {
+        return this->size;
+    }
+
+private:
+    MappedFile( const MappedFile & );
+    MappedFile &operator=( const MappedFile & );
+
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+// 64-bit FNV-1a, used to tie a cache file to the exact bytes of its source asset.
+inline uint64_t HashBytes( const unsigned char *bytes, size_t count, uint64_t hash = 14695981039346656037ULL )
+{
+    for ( size_t i = 0; i < count; i++ )
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*  On-disk layout (all offsets are from the start of the file, blobs are 16 byte aligned)
+    MeshCacheHeader
+    MeshCacheEntry[meshCount]
+    per mesh: texture table, packed vertices[vertexCount] in QuantizedVertexFormat::Layout( streams ),
+              indices[indexCount] followed directly by LOD indices[lodIndexCount], indexSize (2 or 4) bytes each,
+              MeshCacheLod[lodCount], Vertex[vertexCount]
+    A texture table is textureCount records of { uint32 type, uint32 pathLength, path chars } padded to 4 bytes.
+    Texture paths are relative to the model directory, as named by the source materials.
+    The packed vertices and the indices go to the GPU straight from the mapping; the float vertices are only read
+    by CPU users of the geometry and to pack other streams. */
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint32_t meshCount;
+    uint32_t vertexSize;
+    uint32_t streams;
+    uint32_t reserved;
+    // The QuantizationBounds every mesh is packed against: position min and max, then texcoord min and max
+    float quantization[10];
+};
+
+struct MeshCacheEntry
+{
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureCount;
+    uint32_t indexSize;
+    float boundsMin[3];
+    float boundsMax[3];
+    float boundsRadius;
+    uint32_t reserved;
+    uint64_t textureOffset;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t lodCount;
+    uint32_t lodIndexCount;
+    uint64_t lodOffset;
+    uint64_t packedOffset;
+};
+
+// A MeshLod as stored in the cache.
+struct MeshCacheLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+    uint32_t reserved;
+};
+
+// A material texture reference as stored in the cache, resolved against the model directory on load.
+struct CachedTexture
+{
+    TextureType type;
+    string path;
+};
+
+// A validated view of one mesh inside a mapped cache file. Pointers stay valid while the MeshCache is open.
+struct CachedMesh
+{
+    const Vertex *vertices;
+    const void *packed;
+    GLuint vertexCount;
+    // Every level's indices, lodIndices points right after the full mesh's
+    const void *indices;
+    GLuint indexCount;
+    GLenum indexType;
+    const void *lodIndices;
+    GLuint lodIndexCount;
+    vector<MeshLod> lods;
+    vector<CachedTexture> textures;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    GLfloat boundsRadius;
+};
+
+class MeshCache
+{
+public:
+    /*  Functions  */
+    MeshCache( ) : streams( 0 ), quantization( QuantizationBounds::Empty( ) ) { }
+
+    // Cache files live next to the source asset.
+    static string CachePath( const string &sourcePath )
+    {
+        return sourcePath + ".glcache";
+    }
+
+    // Hashes the source asset so a cache can be matched against it, together with the material libraries an OBJ
+    // names with mtllib: the cached texture lists come from those. Returns false if the source can't be read.
+    static bool HashSource( const string &sourcePath, uint64_t &hash, uint64_t &size )
+    {
+        MappedFile source;
+        if( !source.Open( sourcePath ) )
+        {
+            return false;
+        }
+        hash = HashBytes( source.Data( ), source.Size( ) );
+        size = source.Size( );
+
+        string directory = sourcePath.substr( 0, sourcePath.find_last_of( '/' ) + 1 );
+        vector<string> libraries = materialLibraries( source.Data( ), source.Size( ) );
+        for ( size_t i = 0; i < libraries.size( ); i++ )
+        {
+            // A missing library still counts by name, so creating it later invalidates the cache too
+            hash = HashBytes( ( const unsigned char * )libraries[i].data( ), libraries[i].size( ), hash );
+            MappedFile library;
+            if( library.Open( directory + libraries[i] ) )
+            {
+                hash = HashBytes( library.Data( ), library.Size( ), hash );
+                size += library.Size( );
+            }
+        }
+        return true;
+    }
+
+    // Maps the cache for sourcePath and validates it against the source hash. On success the meshes vector
+    // points straight into the mapping.
+    bool Open( const string &sourcePath, uint64_t sourceHash, uint64_t sourceSize )
+    {
+        this->meshes.clear( );
+        if( !this->file.Open( CachePath( sourcePath ) ) )
+        {
+            return false;
+        }
+
+        const unsigned char *base = this->file.Data( );
+        size_t fileSize = this->file.Size( );
+
+        if( fileSize < sizeof( MeshCacheHeader ) )
+        {
+            return this->reject( );
+        }
+        MeshCacheHeader header;
+        memcpy( &header, base, sizeof( header ) );
+        if( memcmp( header.magic, MESH_CACHE_MAGIC, 4 ) != 0 || header.version != MESH_CACHE_VERSION ||
+            header.vertexSize != sizeof( Vertex ) || header.sourceHash != sourceHash || header.sourceSize != sourceSize ||
+            header.streams == 0 || header.streams > STREAM_ALL )
+        {
+            return this->reject( );
+        }
+        this->streams = ( VertexStreamMask )header.streams;
+        this->quantization.positionMin = glm::vec3( header.quantization[0], header.quantization[1], header.quantization[2] );
+        this->quantization.positionMax = glm::vec3( header.quantization[3], header.quantization[4], header.quantization[5] );
+        this->quantization.texCoordMin = glm::vec2( header.quantization[6], header.quantization[7] );
+        this->quantization.texCoordMax = glm::vec2( header.quantization[8], header.quantization[9] );
+        uint64_t stride = QuantizedVertexFormat::Layout( this->streams ).stride;
+        if( ( fileSize - sizeof( MeshCacheHeader ) ) / sizeof( MeshCacheEntry ) < header.meshCount )
+        {
+            return this->reject( );
+        }
+
+        this->meshes.resize( header.meshCount );
+        for ( GLuint i = 0; i < header.meshCount; i++ )
+        {
+            MeshCacheEntry entry;
+            memcpy( &entry, base + sizeof( MeshCacheHeader ) + i * sizeof( MeshCacheEntry ), sizeof( entry ) );
+
+            GLenum indexType = entry.indexSize == sizeof( GLushort ) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            uint64_t indexBytes = ( uint64_t )entry.indexCount * entry.indexSize;
+            if( ( entry.indexSize != sizeof( GLushort ) && entry.indexSize != sizeof( GLuint ) ) ||
+                !inRange( entry.vertexOffset, ( uint64_t )entry.vertexCount * sizeof( Vertex ), fileSize ) ||
+                !inRange( entry.packedOffset, ( uint64_t )entry.vertexCount * stride, fileSize ) ||
+                !inRange( entry.indexOffset, indexBytes + ( uint64_t )entry.lodIndexCount * entry.indexSize, fileSize ) ||
+                !inRange( entry.lodOffset, ( uint64_t )entry.lodCount * sizeof( MeshCacheLod ), fileSize ) ||
+                entry.lodCount >= MAX_LOD_LEVELS || entry.vertexOffset % 16 != 0 || entry.packedOffset % 16 != 0 ||
+                entry.indexOffset % 16 != 0 || entry.indexCount % 3 != 0 || entry.lodIndexCount % 3 != 0 ||
+                !indicesInRange( base + entry.indexOffset, entry.indexCount + entry.lodIndexCount, entry.indexSize, entry.vertexCount ) )
+            {
+                return this->reject( );
+            }
+
+            CachedMesh &mesh = this->meshes[i];
+            mesh.vertices = ( const Vertex * )( base + entry.vertexOffset );
+            mesh.packed = base + entry.packedOffset;
+            mesh.vertexCount = entry.vertexCount;
+            mesh.indices = base + entry.indexOffset;
+            mesh.indexCount = entry.indexCount;
+            mesh.indexType = indexType;
+            mesh.lodIndices = base + entry.indexOffset + indexBytes;
+            mesh.lodIndexCount = entry.lodIndexCount;
+            for ( GLuint j = 0; j < entry.lodCount; j++ )
+            {
+                MeshCacheLod record;
+                memcpy( &record, base + entry.lodOffset + j * sizeof( MeshCacheLod ), sizeof( record ) );
+                if( ( uint64_t )record.firstIndex + record.indexCount > entry.lodIndexCount || record.firstIndex % 3 != 0 ||
+                    record.indexCount % 3 != 0 )
+                {
+                    return this->reject( );
+                }
+                MeshLod lod;
+                lod.firstIndex = record.firstIndex;
+                lod.indexCount = record.indexCount;
+                lod.error = record.error;
+                mesh.lods.push_back( lod );
+            }
+            mesh.boundsMin = glm::vec3( entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2] );
+            mesh.boundsMax = glm::vec3( entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2] );
+            mesh.boundsRadius = entry.boundsRadius;
+
+            uint64_t cursor = entry.textureOffset;
+            for ( GLuint j = 0; j < entry.textureCount; j++ )
+            {
+                uint32_t record[2];
+                if( !inRange( cursor, sizeof( record ), fileSize ) )
+                {
+                    return this->reject( );
+                }
+                memcpy( record, base + cursor, sizeof( record ) );
+                cursor += sizeof( record );
+                if( record[0] > TEXTURE_SPECULAR || !inRange( cursor, record[1], fileSize ) )
+                {
+                    return this->reject( );
+                }
+                CachedTexture texture;
+                texture.type = ( TextureType )record[0];
+                texture.path.assign( ( const char * )base + cursor, record[1] );
+                mesh.textures.push_back( texture );
+                cursor = align( cursor + record[1], 4 );
+            }
+        }
+
+        return true;
+    }
+
+    // Writes meshes to the cache for sourcePath, texturePaths gives the material-relative path of every texture handle used.
+    // The meshes need their CPU arrays; their vertices are stored packed for streams against quantization too.
+    // The file is written under a temporary name and renamed into place so a crash mid-write never leaves a truncated cache behind.
+    static bool Write( const string &sourcePath, uint64_t sourceHash, uint64_t sourceSize, const vector<Mesh> &meshes,
+                       const map<TextureHandle, string> &texturePaths, VertexStreamMask streams, const QuantizationBounds &quantization )
+    {
+        string path = CachePath( sourcePath );
+        string tempPath = path + ".tmp";
+
+        MeshCacheHeader header;
+        memcpy( header.magic, MESH_CACHE_MAGIC, 4 );
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.sourceSize = sourceSize;
+        header.meshCount = ( uint32_t )meshes.size( );
+        header.vertexSize = sizeof( Vertex );
+        header.streams = streams;
+        header.reserved = 0;
+        const float bounds[10] = { quantization.positionMin.x, quantization.positionMin.y, quantization.positionMin.z,
+                                   quantization.positionMax.x, quantization.positionMax.y, quantization.positionMax.z,
+                                   quantization.texCoordMin.x, quantization.texCoordMin.y, quantization.texCoordMax.x,
+                                   quantization.texCoordMax.y };
+        memcpy( header.quantization, bounds, sizeof( bounds ) );
+        uint64_t stride = QuantizedVertexFormat::Layout( streams ).stride;
+
+        // Lay out every section first so the entry table can be written up front.
+        vector<MeshCacheEntry> entries( meshes.size( ) );
+        uint64_t cursor = sizeof( MeshCacheHeader ) + meshes.size( ) * sizeof( MeshCacheEntry );
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            const Mesh &mesh = meshes[i];
+            MeshCacheEntry &entry = entries[i];
+            memset( &entry, 0, sizeof( entry ) );
+            entry.vertexCount = ( uint32_t )mesh.vertices.size( );
+            entry.indexCount = ( uint32_t )mesh.indices.Size( );
+            entry.indexSize = ( uint32_t )IndexArray::TypeSize( mesh.indices.Type( ) );
+            entry.textureCount = ( uint32_t )mesh.textures.size( );
+            for ( int k = 0; k < 3; k++ )
+            {
+                entry.boundsMin[k] = mesh.boundsMin[k];
+                entry.boundsMax[k] = mesh.boundsMax[k];
+            }
+            entry.boundsRadius = mesh.boundsRadius;
+
+            entry.textureOffset = cursor;
+            for ( GLuint j = 0; j < mesh.textures.size( ); j++ )
+            {
+                cursor = align( cursor + 2 * sizeof( uint32_t ) + texturePath( texturePaths, mesh.textures[j] ).size( ), 4 );
+            }
+            entry.packedOffset = align( cursor, 16 );
+            cursor = entry.packedOffset + entry.vertexCount * stride;
+            entry.lodCount = ( uint32_t )mesh.lods.size( );
+            entry.lodIndexCount = ( uint32_t )mesh.lodIndices.Size( );
+            entry.indexOffset = align( cursor, 16 );
+            cursor = entry.indexOffset + mesh.indices.Bytes( ) + mesh.lodIndices.Bytes( );
+            entry.lodOffset = align( cursor, 16 );
+            cursor = entry.lodOffset + entry.lodCount * sizeof( MeshCacheLod );
+            entry.vertexOffset = align( cursor, 16 );
+            cursor = entry.vertexOffset + entry.vertexCount * sizeof( Vertex );
+        }
+
+        ofstream out( tempPath.c_str( ), ios::binary | ios::trunc );
+        if( !out )
+        {
+            cout << "ERROR::MESHCACHE:: could not write " << tempPath << endl;
+            return false;
+        }
+
+        out.write( ( const char * )&header, sizeof( header ) );
+        if( !entries.empty( ) )
+        {
+            out.write( ( const char * )&entries[0], entries.size( ) * sizeof( MeshCacheEntry ) );
+        }
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            const Mesh &mesh = meshes[i];
+            const MeshCacheEntry &entry = entries[i];
+
+            for ( GLuint j = 0; j < mesh.textures.size( ); j++ )
+            {
+                const string &path = texturePath( texturePaths, mesh.textures[j] );
+                uint32_t record[2] = { ( uint32_t )mesh.textures[j].type, ( uint32_t )path.size( ) };
+                out.write( ( const char * )record, sizeof( record ) );
+                out.write( path.data( ), record[1] );
+                pad( out, 4 );
+            }
+            pad( out, 16 );
+            if( entry.vertexCount )
+            {
+                vector<unsigned char> packed;
+                QuantizedVertexFormat::Pack( mesh.vertices.data( ), entry.vertexCount, streams, quantization, packed );
+                out.write( ( const char * )packed.data( ), packed.size( ) );
+            }
+            pad( out, 16 );
+            if( entry.indexCount )
+            {
+                out.write( ( const char * )mesh.indices.Data( ), mesh.indices.Bytes( ) );
+            }
+            if( entry.lodIndexCount )
+            {
+                out.write( ( const char * )mesh.lodIndices.Data( ), mesh.lodIndices.Bytes( ) );
+            }
+            pad( out, 16 );
+            for ( GLuint j = 0; j < entry.lodCount; j++ )
+            {
+                MeshCacheLod record = { mesh.lods[j].firstIndex, mesh.lods[j].indexCount, mesh.lods[j].error, 0 };
+                out.write( ( const char * )&record, sizeof( record ) );
+            }
+            pad( out, 16 );
+            if( entry.vertexCount )
+            {
+                out.write( ( const char * )&mesh.vertices[0], entry.vertexCount * sizeof( Vertex ) );
+            }
+        }
+        out.close( );
+
+        if( !out )
+        {
+            remove( tempPath.c_str( ) );
+            cout << "ERROR::MESHCACHE:: could not write " << tempPath << endl;
+            return false;
+        }
+
+        remove( path.c_str( ) );
+        if( rename( tempPath.c_str( ), path.c_str( ) ) != 0 )
+        {
+            remove( tempPath.c_str( ) );
+            return false;
+        }
+        return true;
+    }
+
+    const vector<CachedMesh> &Meshes( ) const
+    {
+        return this->meshes;
+    }
+
+    // The streams the packed vertices hold and the bounds they were packed against.
+    VertexStreamMask Streams( ) const
+    {
+        return this->streams;
+    }
+
+    const QuantizationBounds &Quantization( ) const
+    {
+        return this->quantization;
+    }
+
+private:
+    /*  Cache Data  */
+    MappedFile file;
+    vector<CachedMesh> meshes;
+    VertexStreamMask streams;
+    QuantizationBounds quantization;
+
+    /*  Functions   */
+    bool reject( )
+    {
+        this->meshes.clear( );
+        this->file.Close( );
+        return false;
+    }
+
+    // The file names of every mtllib line in an OBJ, the rest of the line trimmed, as Assimp reads them
+    static vector<string> materialLibraries( const unsigned char *text, size_t size )
+    {
+        static const char keyword[] = "mtllib";
+        const size_t keywordLength = sizeof( keyword ) - 1;
+        vector<string> libraries;
+        for ( size_t line = 0; line < size; )
+        {
+            size_t end = line;
+            while( end < size && text[end] != '\n' )
+            {
+                end++;
+            }
+            if( end - line > keywordLength && memcmp( text + line, keyword, keywordLength ) == 0 &&
+                isspace( text[line + keywordLength] ) )
+            {
+                size_t first = line + keywordLength, last = end;
+                while( first < last && isspace( text[first] ) )
+                {
+                    first++;
+                }
+                while( last > first && isspace( text[last - 1] ) )
+                {
+                    last--;
+                }
+                if( last > first )
+                {
+                    libraries.push_back( string( ( const char * )text + first, last - first ) );
+                }
+            }
+            line = end + 1;
+        }
+        return libraries;
+    }
+
+    // Whether all count indices of size bytes each at indices name one of vertexCount vertices. The meshes index
+    // their CPU vertex arrays with them, a corrupt cache must never get that far.
+    static bool indicesInRange( const unsigned char *indices, uint32_t count, uint32_t size, uint32_t vertexCount )
+    {
+        return size == sizeof( GLushort ) ? indicesBelow( ( const GLushort * )indices, count, vertexCount )
+                                          : indicesBelow( ( const GLuint * )indices, count, vertexCount );
+    }
+
+    // Index blobs are 16 byte aligned in the mapping, they can be read in place
+    template <class Index>
+    static bool indicesBelow( const Index *indices, uint32_t count, uint32_t vertexCount )
+    {
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            if( indices[i] >= vertexCount )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static uint64_t align( uint64_t offset, uint64_t alignment )
+    {
+        return ( offset + alignment - 1 ) / alignment * alignment;
+    }
+
+    static const string &texturePath( const map<TextureHandle, string> &texturePaths, const Texture &texture )
+    {
+        static const string none;
+        map<TextureHandle, string>::const_iterator found = texturePaths.find( texture.handle );
+        return found != texturePaths.end( ) ? found->second : none;
+    }
+
+    static bool inRange( uint64_t offset, uint64_t count, uint64_t fileSize )
+    {
+        return offset <= fileSize && count <= fileSize - offset;
+    }
+
+    static void pad( ofstream &out, uint64_t alignment )
+    {
+        static const char zeros[16] = { 0 };
+        uint64_t position = ( uint64_t )out.tellp( );
+        out.write( zeros, align( position, alignment ) - position );
+    }
+};
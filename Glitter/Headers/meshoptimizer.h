@@ -0,0 +1,790 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+
+using namespace std;
+
+// Before/after numbers for one optimized mesh. ACMR is post-transform cache misses per triangle,
+// ATVR misses per unique vertex (1.0 is ideal), both measured against a 16 entry FIFO.
+struct MeshOptStats
+{
+    GLuint verticesBefore;
+    GLuint verticesAfter;
+    GLuint triangles;
+    float acmrBefore;
+    float acmrAfter;
+    float atvrBefore;
+    float atvrAfter;
+};
+
+// Coarser levels built per mesh by BuildLods, and how far each is allowed to drift from the full mesh in
+// fractions of the mesh's bounding radius. A level that can't get below LOD_MIN_SAVING of the one before
+// it ends the chain.
+const GLfloat LOD_TRIANGLE_RATIOS[MAX_LOD_LEVELS - 1] = { 0.5f, 0.25f, 0.125f };
+const GLfloat LOD_MAX_ERRORS[MAX_LOD_LEVELS - 1] = { 0.01f, 0.03f, 0.08f };
+const GLfloat LOD_MIN_SAVING = 0.8f;
+
+// Import-time index and vertex reordering: welding, vertex cache (Forsyth), overdraw clustering (Sander et al.)
+// and vertex fetch ordering. The triangle set is unchanged, only its order and the vertex order are.
+// Simplify and BuildLods are the exception, they derive coarser index lists over the same vertices.
+class MeshOptimizer
+{
+public:
+    /*  Functions  */
+    // Runs every pass in the order they depend on each other.
+    static MeshOptStats Optimize( vector<Vertex> &vertices, vector<GLuint> &indices )
+    {
+        MeshOptStats stats;
+        stats.verticesBefore = ( GLuint )vertices.size( );
+        stats.triangles = ( GLuint )( indices.size( ) / 3 );
+        AnalyzeVertexCache( indices, vertices.size( ), stats.acmrBefore, stats.atvrBefore );
+
+        WeldVertices( vertices, indices );
+        OptimizeVertexCache( indices, vertices.size( ) );
+        OptimizeOverdraw( indices, vertices );
+        OptimizeVertexFetch( vertices, indices );
+
+        stats.verticesAfter = ( GLuint )vertices.size( );
+        AnalyzeVertexCache( indices, vertices.size( ), stats.acmrAfter, stats.atvrAfter );
+
+        return stats;
+    }
+
+    // Merges bitwise identical vertices and rewrites the indices to match.
+    static void WeldVertices( vector<Vertex> &vertices, vector<GLuint> &indices )
+    {
+        vector<GLuint> remap( vertices.size( ) );
+        vector<Vertex> unique;
+        unique.reserve( vertices.size( ) );
+
+        unordered_map<VertexKey, GLuint, VertexKeyHash> seen;
+        seen.reserve( vertices.size( ) );
+
+        for ( GLuint i = 0; i < vertices.size( ); i++ )
+        {
+            VertexKey key;
+            key.vertex = &vertices[i];
+            unordered_map<VertexKey, GLuint, VertexKeyHash>::const_iterator found = seen.find( key );
+
+            if( found != seen.end( ) )
+            {
+                remap[i] = found->second;
+            }
+            else
+            {
+                remap[i] = ( GLuint )unique.size( );
+                seen[key] = remap[i];
+                unique.push_back( vertices[i] );
+            }
+        }
+
+        for ( GLuint i = 0; i < indices.size( ); i++ )
+        {
+            indices[i] = remap[indices[i]];
+        }
+        vertices.swap( unique );
+    }
+
+    // Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": greedily emits the triangle whose vertices
+    // score highest for an LRU cache, favouring recently used vertices and vertices with few triangles left.
+    static void OptimizeVertexCache( vector<GLuint> &indices, size_t vertexCount )
+    {
+        const int cacheSize = 32;
+        GLuint triangleCount = ( GLuint )( indices.size( ) / 3 );
+        if( triangleCount == 0 )
+        {
+            return;
+        }
+
+        // Triangle adjacency per vertex, in compressed rows
+        vector<GLuint> valence( vertexCount, 0 );
+        for ( GLuint i = 0; i < indices.size( ); i++ )
+        {
+            valence[indices[i]]++;
+        }
+        vector<GLuint> adjacencyStart( vertexCount + 1, 0 );
+        for ( size_t v = 0; v < vertexCount; v++ )
+        {
+            adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+        }
+        vector<GLuint> adjacency( indices.size( ) );
+        vector<GLuint> fill( adjacencyStart.begin( ), adjacencyStart.end( ) - 1 );
+        for ( GLuint t = 0; t < triangleCount; t++ )
+        {
+            for ( int k = 0; k < 3; k++ )
+            {
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+            }
+        }
+
+        vector<float> vertexScore( vertexCount );
+        for ( size_t v = 0; v < vertexCount; v++ )
+        {
+            vertexScore[v] = forsythScore( -1, valence[v], cacheSize );
+        }
+
+        vector<bool> emitted( triangleCount, false );
+
+        vector<GLuint> cache, nextCache;
+        cache.reserve( cacheSize + 3 );
+        nextCache.reserve( cacheSize + 3 );
+
+        vector<GLuint> result;
+        result.reserve( indices.size( ) );
+        GLuint scanCursor = 0;
+        int best = -1;
+
+        for ( GLuint emittedCount = 0; emittedCount < triangleCount; emittedCount++ )
+        {
+            // No candidate among the cached vertices' triangles: take the next unused triangle in input order
+            if( best < 0 )
+            {
+                while( emitted[scanCursor] )
+                {
+                    scanCursor++;
+                }
+                best = ( int )scanCursor;
+            }
+
+            GLuint t = ( GLuint )best;
+            emitted[t] = true;
+
+            nextCache.clear( );
+            for ( int k = 0; k < 3; k++ )
+            {
+                GLuint v = indices[t * 3 + k];
+                result.push_back( v );
+                if( find( nextCache.begin( ), nextCache.end( ), v ) == nextCache.end( ) )
+                {
+                    nextCache.push_back( v ); // Degenerate triangles name a vertex twice
+                }
+
+                // Remove the triangle from the vertex's adjacency list
+                GLuint begin = adjacencyStart[v], end = begin + valence[v];
+                for ( GLuint a = begin; a < end; a++ )
+                {
+                    if( adjacency[a] == t )
+                    {
+                        adjacency[a] = adjacency[end - 1];
+                        break;
+                    }
+                }
+                valence[v]--;
+            }
+
+            // Most recently used first; whatever falls off the end leaves the cache
+            size_t emittedVertices = nextCache.size( );
+            for ( GLuint i = 0; i < cache.size( ); i++ )
+            {
+                if( find( nextCache.begin( ), nextCache.begin( ) + emittedVertices, cache[i] ) == nextCache.begin( ) + emittedVertices )
+                {
+                    nextCache.push_back( cache[i] );
+                }
+            }
+            for ( GLuint i = cacheSize; i < nextCache.size( ); i++ )
+            {
+                vertexScore[nextCache[i]] = forsythScore( -1, valence[nextCache[i]], cacheSize );
+            }
+            if( nextCache.size( ) > ( size_t )cacheSize )
+            {
+                nextCache.resize( cacheSize );
+            }
+            cache.swap( nextCache );
+
+            // Rescore the cached vertices and the triangles that still use them, picking the best for the next step
+            for ( GLuint i = 0; i < cache.size( ); i++ )
+            {
+                vertexScore[cache[i]] = forsythScore( ( int )i, valence[cache[i]], cacheSize );
+            }
+
+            best = -1;
+            float bestScore = -1.0f;
+            for ( GLuint i = 0; i < cache.size( ); i++ )
+            {
+                GLuint v = cache[i];
+                for ( GLuint a = adjacencyStart[v]; a < adjacencyStart[v] + valence[v]; a++ )
+                {
+                    GLuint candidate = adjacency[a];
+                    float score = vertexScore[indices[candidate * 3]] + vertexScore[indices[candidate * 3 + 1]] + vertexScore[indices[candidate * 3 + 2]];
+                    if( score > bestScore )
+                    {
+                        bestScore = score;
+                        best = ( int )candidate;
+                    }
+                }
+            }
+        }
+
+        indices.swap( result );
+    }
+
+    // Splits the cache-ordered triangles into clusters that barely hurt the cache (hard boundaries where the cache
+    // restarts, soft boundaries where the running ACMR reaches threshold x the cluster's) and draws outward facing
+    // clusters first, so the silhouette occludes the inside and less gets shaded twice.
+    static void OptimizeOverdraw( vector<GLuint> &indices, const vector<Vertex> &vertices, float threshold = 1.05f )
+    {
+        const GLuint cacheSize = 16;
+        GLuint triangleCount = ( GLuint )( indices.size( ) / 3 );
+        if( triangleCount < 2 )
+        {
+            return;
+        }
+
+        // Hard boundaries: a triangle that misses on all three vertices starts a new cluster
+        vector<GLuint> timestamps( vertices.size( ), 0 );
+        GLuint time = cacheSize + 1;
+        vector<GLuint> hard;
+        for ( GLuint t = 0; t < triangleCount; t++ )
+        {
+            if( fifoMisses( &indices[t * 3], timestamps, time, cacheSize ) == 3 || t == 0 )
+            {
+                hard.push_back( t );
+            }
+        }
+        hard.push_back( triangleCount );
+
+        // Soft boundaries inside every hard cluster
+        vector<GLuint> clusters;
+        for ( GLuint h = 0; h + 1 < hard.size( ); h++ )
+        {
+            GLuint start = hard[h], end = hard[h + 1];
+
+            time += cacheSize + 1;
+            GLuint clusterMisses = 0;
+            for ( GLuint t = start; t < end; t++ )
+            {
+                clusterMisses += fifoMisses( &indices[t * 3], timestamps, time, cacheSize );
+            }
+            float clusterThreshold = threshold * clusterMisses / ( end - start );
+
+            clusters.push_back( start );
+            time += cacheSize + 1;
+            GLuint runningMisses = 0, runningTriangles = 0;
+            for ( GLuint t = start; t < end; t++ )
+            {
+                runningMisses += fifoMisses( &indices[t * 3], timestamps, time, cacheSize );
+                runningTriangles++;
+
+                if( t + 1 < end && ( float )runningMisses / runningTriangles <= clusterThreshold )
+                {
+                    clusters.push_back( t + 1 );
+                    time += cacheSize + 1;
+                    runningMisses = runningTriangles = 0;
+                }
+            }
+        }
+        clusters.push_back( triangleCount );
+
+        // Mesh centroid, then per cluster area weighted centroid and normal
+        glm::vec3 meshCentroid( 0.0f );
+        for ( GLuint i = 0; i < vertices.size( ); i++ )
+        {
+            meshCentroid += vertices[i].Position;
+        }
+        meshCentroid /= ( float )( vertices.empty( ) ? 1 : vertices.size( ) );
+
+        GLuint clusterCount = ( GLuint )clusters.size( ) - 1;
+        vector<float> sortKey( clusterCount );
+        for ( GLuint c = 0; c < clusterCount; c++ )
+        {
+            glm::vec3 centroid( 0.0f ), normal( 0.0f );
+            float area = 0.0f;
+
+            for ( GLuint t = clusters[c]; t < clusters[c + 1]; t++ )
+            {
+                const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+                const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross( p1 - p0, p2 - p0 );
+                float a = glm::length( n );
+
+                centroid += ( p0 + p1 + p2 ) * ( a / 3.0f );
+                normal += n;
+                area += a;
+            }
+
+            float normalLength = glm::length( normal );
+            centroid = area > 0.0f ? centroid / area : meshCentroid;
+            normal = normalLength > 0.0f ? normal / normalLength : glm::vec3( 0.0f );
+            sortKey[c] = glm::dot( centroid - meshCentroid, normal );
+        }
+
+        vector<GLuint> order( clusterCount );
+        for ( GLuint c = 0; c < clusterCount; c++ )
+        {
+            order[c] = c;
+        }
+        stable_sort( order.begin( ), order.end( ), [&sortKey]( GLuint a, GLuint b ) { return sortKey[a] > sortKey[b]; } );
+
+        vector<GLuint> result;
+        result.reserve( indices.size( ) );
+        for ( GLuint i = 0; i < clusterCount; i++ )
+        {
+            GLuint c = order[i];
+            result.insert( result.end( ), indices.begin( ) + clusters[c] * 3, indices.begin( ) + clusters[c + 1] * 3 );
+        }
+        indices.swap( result );
+    }
+
+    // Renumbers vertices in the order the index buffer first touches them and drops unreferenced ones,
+    // so vertex fetch walks memory linearly.
+    static void OptimizeVertexFetch( vector<Vertex> &vertices, vector<GLuint> &indices )
+    {
+        const GLuint unused = 0xFFFFFFFFu;
+        vector<GLuint> remap( vertices.size( ), unused );
+        vector<Vertex> ordered;
+        ordered.reserve( vertices.size( ) );
+
+        for ( GLuint i = 0; i < indices.size( ); i++ )
+        {
+            GLuint &target = remap[indices[i]];
+            if( target == unused )
+            {
+                target = ( GLuint )ordered.size( );
+                ordered.push_back( vertices[indices[i]] );
+            }
+            indices[i] = target;
+        }
+        vertices.swap( ordered );
+    }
+
+    // Appends up to MAX_LOD_LEVELS - 1 simplified index lists for the mesh to lodIndices, each one built from the
+    // level before and vertex cache ordered, and describes them in lods. radius scales the error limits.
+    static void BuildLods( const vector<Vertex> &vertices, const vector<GLuint> &indices, GLfloat radius,
+                           vector<GLuint> &lodIndices, vector<MeshLod> &lods )
+    {
+        vector<GLuint> source = indices;
+        GLfloat error = 0.0f;
+        for ( GLuint level = 0; level + 1 < MAX_LOD_LEVELS; level++ )
+        {
+            size_t target = ( size_t )( indices.size( ) / 3 * LOD_TRIANGLE_RATIOS[level] ) * 3;
+            GLfloat levelError = 0.0f;
+            vector<GLuint> simplified = Simplify( vertices, source, target, LOD_MAX_ERRORS[level] * radius, levelError );
+            if( simplified.empty( ) || simplified.size( ) > source.size( ) * LOD_MIN_SAVING )
+            {
+                break;
+            }
+            OptimizeVertexCache( simplified, vertices.size( ) );
+
+            // Simplifying the previous level rather than the original can only add up the errors
+            error += levelError;
+            MeshLod lod;
+            lod.firstIndex = ( GLuint )lodIndices.size( );
+            lod.indexCount = ( GLuint )simplified.size( );
+            lod.error = error;
+            lods.push_back( lod );
+            lodIndices.insert( lodIndices.end( ), simplified.begin( ), simplified.end( ) );
+            source.swap( simplified );
+        }
+    }
+
+    // Garland and Heckbert's quadric error simplification by half-edge collapses: a vertex moves onto a neighbour
+    // and the triangles between them disappear, so no vertex is ever created and the result indexes the same
+    // vertices. Collapses go cheapest first until the list is down to targetIndexCount or the next one would
+    // move the surface further than maxError. Vertices on a border or an attribute seam (a position shared by
+    // vertices with different normals or texture coordinates) stay put, which keeps outlines and UV islands
+    // intact. error gets the largest distance a collapse moved the surface by, in object units.
+    static vector<GLuint> Simplify( const vector<Vertex> &vertices, const vector<GLuint> &indices, size_t targetIndexCount,
+                                    GLfloat maxError, GLfloat &error )
+    {
+        error = 0.0f;
+        GLuint vertexCount = ( GLuint )vertices.size( );
+        GLuint triangleCount = ( GLuint )( indices.size( ) / 3 );
+
+        // Vertices at one position share a quadric, several vertices at a position mean a seam
+        vector<GLuint> position( vertexCount );
+        vector<GLuint> copies( vertexCount, 0 );
+        unordered_map<PositionKey, GLuint, PositionKeyHash> seen;
+        seen.reserve( vertexCount );
+        for ( GLuint v = 0; v < vertexCount; v++ )
+        {
+            PositionKey key;
+            key.position = &vertices[v].Position;
+            unordered_map<PositionKey, GLuint, PositionKeyHash>::const_iterator found = seen.find( key );
+            position[v] = found != seen.end( ) ? found->second : ( seen[key] = v );
+            copies[position[v]]++;
+        }
+
+        // Edges with one triangle on them are borders, more than two make the surface non-manifold; both lock their ends
+        vector<bool> locked( vertexCount, false );
+        unordered_map<uint64_t, GLuint> edges;
+        edges.reserve( indices.size( ) );
+        for ( GLuint i = 0; i < triangleCount * 3; i++ )
+        {
+            edges[edgeKey( position[indices[i]], position[indices[i - i % 3 + ( i % 3 + 1 ) % 3]] )]++;
+        }
+        for ( unordered_map<uint64_t, GLuint>::const_iterator it = edges.begin( ); it != edges.end( ); ++it )
+        {
+            if( it->second != 2 )
+            {
+                locked[( GLuint )( it->first >> 32 )] = true;
+                locked[( GLuint )( it->first & 0xFFFFFFFFu )] = true;
+            }
+        }
+        for ( GLuint v = 0; v < vertexCount; v++ )
+        {
+            locked[v] = locked[position[v]] || copies[position[v]] > 1;
+        }
+
+        // Area weighted plane quadrics per position, and the triangles around every vertex
+        vector<Quadric> quadrics( vertexCount );
+        vector<vector<GLuint> > around( vertexCount );
+        vector<GLuint> triangles( indices.begin( ), indices.begin( ) + triangleCount * 3 );
+        for ( GLuint t = 0; t < triangleCount; t++ )
+        {
+            const glm::vec3 &p0 = vertices[triangles[t * 3]].Position;
+            glm::vec3 normal = glm::cross( vertices[triangles[t * 3 + 1]].Position - p0, vertices[triangles[t * 3 + 2]].Position - p0 );
+            GLfloat length = glm::length( normal );
+            Quadric plane;
+            if( length > 0.0f )
+            {
+                normal /= length;
+                plane = Quadric::FromPlane( normal, -glm::dot( normal, p0 ), length * 0.5f );
+            }
+            for ( int k = 0; k < 3; k++ )
+            {
+                quadrics[position[triangles[t * 3 + k]]].Add( plane );
+                around[triangles[t * 3 + k]].push_back( t );
+            }
+        }
+
+        priority_queue<Collapse> queue;
+        for ( GLuint i = 0; i < triangleCount * 3; i++ )
+        {
+            GLuint from = triangles[i], to = triangles[i - i % 3 + ( i % 3 + 1 ) % 3];
+            pushCollapse( queue, vertices, quadrics, position, locked, from, to );
+            pushCollapse( queue, vertices, quadrics, position, locked, to, from );
+        }
+
+        // Collapse, re-costing entries that went stale as the quadrics around them grew
+        vector<bool> removed( triangleCount, false );
+        GLuint remaining = triangleCount;
+        while( remaining * 3 > targetIndexCount && !queue.empty( ) )
+        {
+            Collapse collapse = queue.top( );
+            queue.pop( );
+            if( around[collapse.from].empty( ) || !shareTriangle( around[collapse.from], triangles, collapse.to ) )
+            {
+                continue;
+            }
+            GLfloat cost = collapseCost( vertices, quadrics, position, collapse.from, collapse.to );
+            if( cost > collapse.cost * 1.0001f + 1e-12f )
+            {
+                collapse.cost = cost;
+                queue.push( collapse );
+                continue;
+            }
+            if( cost > maxError )
+            {
+                break;
+            }
+            if( flips( vertices, triangles, around[collapse.from], collapse.from, collapse.to ) )
+            {
+                continue;
+            }
+
+            // Triangles on the edge go, the rest move their corner onto to
+            vector<GLuint> moved;
+            moved.swap( around[collapse.from] );
+            for ( GLuint i = 0; i < moved.size( ); i++ )
+            {
+                GLuint t = moved[i];
+                GLuint *corners = &triangles[t * 3];
+                if( corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to )
+                {
+                    removed[t] = true;
+                    remaining--;
+                    for ( int k = 0; k < 3; k++ )
+                    {
+                        if( corners[k] != collapse.from )
+                        {
+                            vector<GLuint> &list = around[corners[k]];
+                            list.erase( find( list.begin( ), list.end( ), t ) );
+                        }
+                    }
+                    continue;
+                }
+                for ( int k = 0; k < 3; k++ )
+                {
+                    if( corners[k] == collapse.from )
+                    {
+                        corners[k] = collapse.to;
+                    }
+                }
+                around[collapse.to].push_back( t );
+            }
+            quadrics[position[collapse.to]].Add( quadrics[position[collapse.from]] );
+            error = max( error, cost );
+
+            // Every edge at to now costs more, queue them again
+            const vector<GLuint> &next = around[collapse.to];
+            for ( GLuint i = 0; i < next.size( ); i++ )
+            {
+                for ( int k = 0; k < 3; k++ )
+                {
+                    GLuint other = triangles[next[i] * 3 + k];
+                    if( other != collapse.to )
+                    {
+                        pushCollapse( queue, vertices, quadrics, position, locked, other, collapse.to );
+                        pushCollapse( queue, vertices, quadrics, position, locked, collapse.to, other );
+                    }
+                }
+            }
+        }
+
+        vector<GLuint> result;
+        result.reserve( remaining * 3 );
+        for ( GLuint t = 0; t < triangleCount; t++ )
+        {
+            if( !removed[t] )
+            {
+                result.insert( result.end( ), triangles.begin( ) + t * 3, triangles.begin( ) + t * 3 + 3 );
+            }
+        }
+        return result;
+    }
+
+    // Simulates a FIFO post-transform cache over the index buffer.
+    static void AnalyzeVertexCache( const vector<GLuint> &indices, size_t vertexCount, float &acmr, float &atvr, GLuint cacheSize = 16 )
+    {
+        vector<GLuint> timestamps( vertexCount, 0 );
+        vector<bool> referenced( vertexCount, false );
+        GLuint time = cacheSize + 1;
+        GLuint misses = 0, unique = 0;
+
+        for ( GLuint t = 0; t + 2 < indices.size( ); t += 3 )
+        {
+            misses += fifoMisses( &indices[t], timestamps, time, cacheSize );
+            for ( int k = 0; k < 3; k++ )
+            {
+                if( !referenced[indices[t + k]] )
+                {
+                    referenced[indices[t + k]] = true;
+                    unique++;
+                }
+            }
+        }
+
+        GLuint triangles = ( GLuint )( indices.size( ) / 3 );
+        acmr = triangles ? ( float )misses / triangles : 0.0f;
+        atvr = unique ? ( float )misses / unique : 0.0f;
+    }
+
+private:
+    // The symmetric 4x4 matrix summing squared distances to a set of planes, plus the area it was weighted by
+    struct Quadric
+    {
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+        double weight;
+
+        Quadric( ) : a2( 0.0 ), ab( 0.0 ), ac( 0.0 ), ad( 0.0 ), b2( 0.0 ), bc( 0.0 ), bd( 0.0 ), c2( 0.0 ), cd( 0.0 ), d2( 0.0 ), weight( 0.0 )
+        {
+        }
+
+        static Quadric FromPlane( glm::vec3 normal, GLfloat distance, GLfloat weight )
+        {
+            Quadric q;
+            double a = normal.x, b = normal.y, c = normal.z, d = distance;
+            q.a2 = weight * a * a; q.ab = weight * a * b; q.ac = weight * a * c; q.ad = weight * a * d;
+            q.b2 = weight * b * b; q.bc = weight * b * c; q.bd = weight * b * d;
+            q.c2 = weight * c * c; q.cd = weight * c * d;
+            q.d2 = weight * d * d;
+            q.weight = weight;
+            return q;
+        }
+
+        void Add( const Quadric &other )
+        {
+            this->a2 += other.a2; this->ab += other.ab; this->ac += other.ac; this->ad += other.ad;
+            this->b2 += other.b2; this->bc += other.bc; this->bd += other.bd;
+            this->c2 += other.c2; this->cd += other.cd;
+            this->d2 += other.d2;
+            this->weight += other.weight;
+        }
+
+        // Weighted sum of squared distances from p to the planes
+        double Evaluate( glm::vec3 p ) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            return this->a2 * x * x + 2.0 * this->ab * x * y + 2.0 * this->ac * x * z + 2.0 * this->ad * x +
+                   this->b2 * y * y + 2.0 * this->bc * y * z + 2.0 * this->bd * y +
+                   this->c2 * z * z + 2.0 * this->cd * z + this->d2;
+        }
+    };
+
+    // Moving from onto to, cheapest first out of a priority_queue
+    struct Collapse
+    {
+        GLfloat cost;
+        GLuint from;
+        GLuint to;
+
+        bool operator<( const Collapse &other ) const
+        {
+            return this->cost > other.cost;
+        }
+    };
+
+    // Bit-wise identity of a position, for finding the vertices split along a seam.
+    struct PositionKey
+    {
+        const glm::vec3 *position;
+
+        bool operator==( const PositionKey &other ) const
+        {
+            return memcmp( this->position, other.position, sizeof( glm::vec3 ) ) == 0;
+        }
+    };
+
+    struct PositionKeyHash
+    {
+        size_t operator( )( const PositionKey &key ) const
+        {
+            const unsigned char *bytes = ( const unsigned char * )key.position;
+            size_t hash = 2166136261u;
+            for ( size_t i = 0; i < sizeof( glm::vec3 ); i++ )
+            {
+                hash = ( hash ^ bytes[i] ) * 16777619u;
+            }
+            return hash;
+        }
+    };
+
+    static uint64_t edgeKey( GLuint a, GLuint b )
+    {
+        return a < b ? ( ( uint64_t )a << 32 ) | b : ( ( uint64_t )b << 32 ) | a;
+    }
+
+    // RMS distance to the planes of both ends, with from moved onto to
+    static GLfloat collapseCost( const vector<Vertex> &vertices, const vector<Quadric> &quadrics, const vector<GLuint> &position,
+                                 GLuint from, GLuint to )
+    {
+        Quadric q = quadrics[position[from]];
+        q.Add( quadrics[position[to]] );
+        return q.weight > 0.0 ? ( GLfloat )sqrt( max( q.Evaluate( vertices[to].Position ), 0.0 ) / q.weight ) : 0.0f;
+    }
+
+    static void pushCollapse( priority_queue<Collapse> &queue, const vector<Vertex> &vertices, const vector<Quadric> &quadrics,
+                              const vector<GLuint> &position, const vector<bool> &locked, GLuint from, GLuint to )
+    {
+        if( locked[from] )
+        {
+            return;
+        }
+        Collapse collapse;
+        collapse.cost = collapseCost( vertices, quadrics, position, from, to );
+        collapse.from = from;
+        collapse.to = to;
+        queue.push( collapse );
+    }
+
+    static bool shareTriangle( const vector<GLuint> &around, const vector<GLuint> &triangles, GLuint vertex )
+    {
+        for ( GLuint i = 0; i < around.size( ); i++ )
+        {
+            const GLuint *corners = &triangles[around[i] * 3];
+            if( corners[0] == vertex || corners[1] == vertex || corners[2] == vertex )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether moving from onto to would turn any surviving triangle around from over or squash it flat
+    static bool flips( const vector<Vertex> &vertices, const vector<GLuint> &triangles, const vector<GLuint> &around, GLuint from, GLuint to )
+    {
+        for ( GLuint i = 0; i < around.size( ); i++ )
+        {
+            const GLuint *corners = &triangles[around[i] * 3];
+            if( corners[0] == to || corners[1] == to || corners[2] == to )
+            {
+                continue;
+            }
+            glm::vec3 before[3], after[3];
+            for ( int k = 0; k < 3; k++ )
+            {
+                before[k] = vertices[corners[k]].Position;
+                after[k] = vertices[corners[k] == from ? to : corners[k]].Position;
+            }
+            glm::vec3 oldNormal = glm::cross( before[1] - before[0], before[2] - before[0] );
+            glm::vec3 newNormal = glm::cross( after[1] - after[0], after[2] - after[0] );
+            if( glm::dot( oldNormal, newNormal ) <= 0.0f )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Byte-wise identity of a vertex, for welding.
+    struct VertexKey
+    {
+        const Vertex *vertex;
+
+        bool operator==( const VertexKey &other ) const
+        {
+            return memcmp( this->vertex, other.vertex, sizeof( Vertex ) ) == 0;
+        }
+    };
+
+    struct VertexKeyHash
+    {
+        size_t operator( )( const VertexKey &key ) const
+        {
+            const unsigned char *bytes = ( const unsigned char * )key.vertex;
+            size_t hash = 2166136261u;
+            for ( size_t i = 0; i < sizeof( Vertex ); i++ )
+            {
+                hash = ( hash ^ bytes[i] ) * 16777619u;
+            }
+            return hash;
+        }
+    };
+
+    static float forsythScore( int cachePosition, GLuint remainingTriangles, int cacheSize )
+    {
+        if( remainingTriangles == 0 )
+        {
+            return -1.0f; // No triangles left to use this vertex
+        }
+
+        float score = 0.0f;
+        if( cachePosition >= 0 )
+        {
+            if( cachePosition < 3 )
+            {
+                score = 0.75f; // Used by the last triangle, fixed score so it isn't preferred over its neighbours
+            }
+            else
+            {
+                score = pow( 1.0f - ( float )( cachePosition - 3 ) / ( cacheSize - 3 ), 1.5f );
+            }
+        }
+
+        // Boost vertices with few triangles left so lone triangles don't get stranded
+        return score + 2.0f / sqrt( ( float )remainingTriangles );
+    }
+
+    // Misses for one triangle against a FIFO of cacheSize entries, tracked with per-vertex insertion times.
+    static GLuint fifoMisses( const GLuint *triangle, vector<GLuint> &timestamps, GLuint &time, GLuint cacheSize )
+    {
+        GLuint misses = 0;
+        for ( int k = 0; k < 3; k++ )
+        {
+            if( time - timestamps[triangle[k]] > cacheSize )
+            {
+                timestamps[triangle[k]] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+};
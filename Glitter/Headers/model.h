@@ -1,10 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <utility>
 #include <vector>
 #include "glitter.hpp"
 
@@ -17,40 +21,308 @@
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "meshcache.h"
+#include "meshoptimizer.h"
+#include "textureloader.h"
 
 using namespace std;
 
-GLint TextureFromFile( const char *path, string directory );
-
 class Model
 {
 public:
     /*  Functions   */
-    // Constructor, expects a filepath to a 3D model.
-    Model( GLchar *path )
+    // Constructor, expects a filepath to a 3D model and the vertex streams its shaders consume.
+    Model( const string &path, VertexStreamMask streams = STREAM_ALL ) : path( path ), streams( streams ), occluder( false ), occluderLod( 0 )
     {
         this->loadModel( path );
+        
+        // Textures were decoded on the worker pool while the meshes were built, upload them now
+        TextureLoader::Instance( ).Flush( );
+    }
+    
+    // Models own GPU buffers and texture references, they can be moved but never copied
+    Model( Model && ) = default;
+    Model &operator=( Model && ) = default;
+    Model( const Model & ) = delete;
+    Model &operator=( const Model & ) = delete;
+    
+    // Draws the model, and thus all its meshes. Consecutive meshes that share a material go out as one multi-draw.
+    void Draw( Shader &shader ) const
+    {
+        DrawElementsIndirectCommand commands[MAX_MULTI_DRAW];
+        for ( GLuint i = 0; i < this->meshes.size( ); )
+        {
+            const Mesh &first = this->meshes[i];
+            GLuint count = 0;
+            while( i < this->meshes.size( ) && count < MAX_MULTI_DRAW && this->meshes[i].CanBatchWith( first, shader ) )
+            {
+                commands[count++] = this->meshes[i++].Command( 1, 0 );
+            }
+            
+            first.Bind( shader );
+            first.Arena( ).Draw( commands, count, 0 );
+        }
+    }
+    
+    // Resolves every mesh's material for shader up front, keeping that work out of the first frame.
+    void BakeMaterials( const Shader &shader )
+    {
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            this->meshes[i].BakeMaterial( shader );
+        }
+    }
+    
+    // Bytes of vertex, index and material data kept in system memory.
+    size_t CpuBytes( ) const
+    {
+        size_t bytes = 0;
+        
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            bytes += this->meshes[i].CpuBytes( );
+        }
+        
+        return bytes;
+    }
+    
+    // Bytes of vertex and index buffers owned by this model plus every texture it references.
+    // Textures shared with other models are counted in full for each of them.
+    size_t GpuBytes( ) const
+    {
+        size_t bytes = 0;
+        
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            bytes += this->meshes[i].GpuBytes( );
+        }
+        
+        for ( map<TextureHandle, string>::const_iterator it = this->texturePaths.begin( ); it != this->texturePaths.end( ); ++it )
+        {
+            bytes += TextureRegistry::Instance( ).Bytes( it->first );
+        }
+        
+        return bytes;
+    }
+    
+    // Makes sure every stream in streams is uploaded, for when another shader starts drawing this model.
+    void RequireStreams( VertexStreamMask streams )
+    {
+        if( ( this->streams | streams ) == this->streams )
+        {
+            return;
+        }
+        
+        // Meshes without CPU arrays are packed again from the float vertices in the cache
+        this->streams |= streams;
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            const CachedMesh *cached = this->cache ? &this->cache->Meshes( )[i] : NULL;
+            this->meshes[i].SetStreams( this->streams, cached ? cached->vertices : NULL, cached ? cached->indices : NULL );
+        }
+    }
+    
+    // Gives every mesh CPU copies of its float vertices and indices, for the users that read the geometry
+    // itself: collision shapes and the occlusion buffer. Models only keep them once something asks.
+    void RequireCpuGeometry( )
+    {
+        if( !this->cache )
+        {
+            return;
+        }
+        
+        const vector<CachedMesh> &cached = this->cache->Meshes( );
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            const CachedMesh &mesh = cached[i];
+            this->meshes[i].SetCpuGeometry( vector<Vertex>( mesh.vertices, mesh.vertices + mesh.vertexCount ),
+                                            IndexArray( mesh.indices, mesh.indexCount, mesh.indexType ),
+                                            IndexArray( mesh.lodIndices, mesh.lodIndexCount, mesh.indexType ) );
+        }
+        this->cache.reset( );
+    }
+    
+    const vector<Mesh> &Meshes( ) const
+    {
+        return this->meshes;
+    }
+    
+    // Object space bounds of the whole model: a box and the sphere around its centre that holds every mesh.
+    glm::vec3 BoundsMin( ) const
+    {
+        return this->boundsMin;
+    }
+    
+    glm::vec3 BoundsMax( ) const
+    {
+        return this->boundsMax;
+    }
+    
+    glm::vec3 BoundsCenter( ) const
+    {
+        return ( this->boundsMin + this->boundsMax ) * 0.5f;
+    }
+    
+    GLfloat BoundsRadius( ) const
+    {
+        return this->boundsRadius;
     }
     
-    // Draws the model, and thus all its meshes
-    void Draw( Shader shader )
+    GLuint MeshCount( ) const
     {
+        return ( GLuint )this->meshes.size( );
+    }
+    
+    // Detail levels of the most detailed mesh; meshes with fewer draw their coarsest past that.
+    GLuint LodCount( ) const
+    {
+        return this->lodCount;
+    }
+    
+    // The most any mesh strays from its full detail at level lod, in object units.
+    GLfloat LodError( GLuint lod ) const
+    {
+        return this->lodErrors[std::min( lod, this->lodCount - 1 )];
+    }
+    
+    // Triangles in one draw of the whole model at level lod.
+    GLuint TriangleCount( GLuint lod = 0 ) const
+    {
+        GLuint triangles = 0;
         for ( GLuint i = 0; i < this->meshes.size( ); i++ )
         {
-            this->meshes[i].Draw( shader );
+            triangles += this->meshes[i].TriangleCount( lod );
         }
+        return triangles;
+    }
+    
+    // The file the model was loaded from, caches derived from it live next to it.
+    const string &Path( ) const
+    {
+        return this->path;
+    }
+    
+    // Marks the model as an occluder for the software depth buffer, drawn there at detail level lod or its
+    // coarsest level if it has fewer. Only level 0 is guaranteed to stay inside the model. The buffer reads
+    // the CPU geometry, so occluders keep it.
+    void SetOccluder( bool occluder, GLuint lod = 0 )
+    {
+        if( occluder )
+        {
+            this->RequireCpuGeometry( );
+        }
+        this->occluder = occluder;
+        this->occluderLod = std::min( lod, this->lodCount - 1 );
+    }
+    
+    bool IsOccluder( ) const
+    {
+        return this->occluder;
+    }
+    
+    GLuint OccluderLod( ) const
+    {
+        return this->occluderLod;
     }
     
 private:
     /*  Model Data  */
     vector<Mesh> meshes;
+    string path;
     string directory;
-    vector<Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    VertexStreamMask streams;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    GLfloat boundsRadius;
+    GLuint lodCount;
+    GLfloat lodErrors[MAX_LOD_LEVELS];
+    map<TextureHandle, string> texturePaths;	// Material-relative path of every texture this model holds a reference to, written to the mesh cache.
+    bool occluder;
+    GLuint occluderLod;
+    // The bounds every mesh is packed against, so they all share one set of dequantization uniforms
+    QuantizationBounds quantization;
+    // The mapped cache the meshes were uploaded from while they have no CPU arrays, see RequireCpuGeometry
+    unique_ptr<MeshCache> cache;
     
     /*  Functions   */
+    // Packs every mesh against the bounds of the whole model and uploads it from its CPU arrays
+    void upload( )
+    {
+        this->computeBounds( );
+        this->computeLods( );
+        
+        this->quantization = QuantizationBounds::Empty( );
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            this->quantization.Include( this->meshes[i].vertices.data( ), this->meshes[i].vertices.size( ) );
+        }
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            this->meshes[i].Upload( this->quantization );
+        }
+    }
+    
+    // Model bounds enclose every mesh's box and sphere
+    void computeBounds( )
+    {
+        this->boundsMin = this->boundsMax = glm::vec3( 0.0f );
+        this->boundsRadius = 0.0f;
+        if( this->meshes.empty( ) )
+        {
+            return;
+        }
+        
+        this->boundsMin = this->meshes[0].boundsMin;
+        this->boundsMax = this->meshes[0].boundsMax;
+        for ( GLuint i = 1; i < this->meshes.size( ); i++ )
+        {
+            this->boundsMin = glm::min( this->boundsMin, this->meshes[i].boundsMin );
+            this->boundsMax = glm::max( this->boundsMax, this->meshes[i].boundsMax );
+        }
+        
+        glm::vec3 center = this->BoundsCenter( );
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            const Mesh &mesh = this->meshes[i];
+            GLfloat reach = glm::length( ( mesh.boundsMin + mesh.boundsMax ) * 0.5f - center ) + mesh.boundsRadius;
+            this->boundsRadius = glm::max( this->boundsRadius, reach );
+        }
+    }
+    
+    // A level of the model is that level of every mesh, so its error is the largest of theirs
+    void computeLods( )
+    {
+        this->lodCount = 1;
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            this->lodCount = std::max( this->lodCount, this->meshes[i].LodCount( ) );
+        }
+        for ( GLuint lod = 0; lod < MAX_LOD_LEVELS; lod++ )
+        {
+            this->lodErrors[lod] = 0.0f;
+            for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+            {
+                this->lodErrors[lod] = std::max( this->lodErrors[lod], this->meshes[i].LodError( lod ) );
+            }
+        }
+    }
+    
     // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // A binary cache built from the same source bytes is used instead of ASSIMP when one exists.
     void loadModel( string path )
     {
+        // Retrieve the directory path of the filepath
+        this->directory = path.substr( 0, path.find_last_of( '/' ) );
+        
+        // Hash the source and its material libraries so a stale cache (edited or replaced asset) is never used
+        uint64_t sourceHash = 0, sourceSize = 0;
+        bool hashed = MeshCache::HashSource( path, sourceHash, sourceSize );
+        
+        if( hashed && this->loadCache( path, sourceHash, sourceSize ) )
+        {
+            return;
+        }
+        
         // Read file via ASSIMP
         Assimp::Importer importer;
         const aiScene *scene = importer.ReadFile( path, aiProcess_Triangulate | aiProcess_FlipUVs );
@@ -59,13 +331,69 @@ private:
         if( !scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode ) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString( ) << endl;
+            this->upload( ); // Nothing to upload, but the bounds and levels still get their empty values
             return;
         }
-        // Retrieve the directory path of the filepath
-        this->directory = path.substr( 0, path.find_last_of( '/' ) );
         
         // Process ASSIMP's root node recursively
         this->processNode( scene->mRootNode, scene );
+        this->upload( );
+        
+        // Store the result so the next start can skip ASSIMP entirely. Once it is on disk the CPU arrays
+        // can go, like after a cached load
+        if( hashed && MeshCache::Write( path, sourceHash, sourceSize, this->meshes, this->texturePaths, this->streams, this->quantization ) )
+        {
+            unique_ptr<MeshCache> written( new MeshCache( ) );
+            if( written->Open( path, sourceHash, sourceSize ) && written->Meshes( ).size( ) == this->meshes.size( ) )
+            {
+                this->cache = std::move( written );
+                for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+                {
+                    this->meshes[i].ReleaseCpuGeometry( );
+                }
+            }
+        }
+    }
+    
+    // Builds the meshes from a valid binary cache. The packed vertex and index blobs are uploaded straight from the
+    // mapped file, which stays open: the meshes keep no CPU arrays until RequireCpuGeometry copies them out.
+    // Only a model asking for other streams than the cache holds packs them, from the cached float vertices.
+    bool loadCache( const string &path, uint64_t sourceHash, uint64_t sourceSize )
+    {
+        unique_ptr<MeshCache> cache( new MeshCache( ) );
+        
+        if( !cache->Open( path, sourceHash, sourceSize ) )
+        {
+            return false;
+        }
+        
+        const vector<CachedMesh> &cached = cache->Meshes( );
+        
+        for ( GLuint i = 0; i < cached.size( ); i++ )
+        {
+            const CachedMesh &mesh = cached[i];
+            vector<Texture> textures;
+            
+            for ( GLuint j = 0; j < mesh.textures.size( ); j++ )
+            {
+                textures.push_back( this->loadTexture( mesh.textures[j].path.c_str( ), mesh.textures[j].type ) );
+            }
+            
+            this->meshes.emplace_back( mesh.vertexCount, mesh.indexCount, mesh.lodIndexCount, mesh.indexType, vector<MeshLod>( mesh.lods ),
+                                       std::move( textures ), mesh.boundsMin, mesh.boundsMax, mesh.boundsRadius, this->streams );
+        }
+        
+        this->computeBounds( );
+        this->computeLods( );
+        this->quantization = cache->Quantization( );
+        bool packed = cache->Streams( ) == this->streams;
+        for ( GLuint i = 0; i < cached.size( ); i++ )
+        {
+            this->meshes[i].Upload( this->quantization, cached[i].vertices, packed ? cached[i].packed : NULL, cached[i].indices );
+        }
+        
+        this->cache = std::move( cache );
+        return true;
     }
     
     // Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -94,6 +422,7 @@ private:
         vector<Vertex> vertices;
         vector<GLuint> indices;
         vector<Texture> textures;
+        glm::vec3 boundsMin( 0.0f ), boundsMax( 0.0f );
         
         // Walk through each of the mesh's vertices
         for ( GLuint i = 0; i < mesh->mNumVertices; i++ )
@@ -107,6 +436,14 @@ private:
             vector.z = mesh->mVertices[i].z;
             vertex.Position = vector;
             
+            // Grow the bounds
+            if( i == 0 )
+            {
+                boundsMin = boundsMax = vector;
+            }
+            boundsMin = glm::min( boundsMin, vector );
+            boundsMax = glm::max( boundsMax, vector );
+            
             // Normals
             vector.x = mesh->mNormals[i].x;
             vector.y = mesh->mNormals[i].y;
@@ -154,21 +491,51 @@ private:
             // Normal: texture_normalN
             
             // 1. Diffuse maps
-            vector<Texture> diffuseMaps = this->loadMaterialTextures( material, aiTextureType_DIFFUSE, "texture_diffuse" );
-            textures.insert( textures.end( ), diffuseMaps.begin( ), diffuseMaps.end( ) );
+            vector<Texture> diffuseMaps = this->loadMaterialTextures( material, aiTextureType_DIFFUSE, TEXTURE_DIFFUSE );
+            textures.insert( textures.end( ), make_move_iterator( diffuseMaps.begin( ) ), make_move_iterator( diffuseMaps.end( ) ) );
             
             // 2. Specular maps
-            vector<Texture> specularMaps = this->loadMaterialTextures( material, aiTextureType_SPECULAR, "texture_specular" );
-            textures.insert( textures.end( ), specularMaps.begin( ), specularMaps.end( ) );
+            vector<Texture> specularMaps = this->loadMaterialTextures( material, aiTextureType_SPECULAR, TEXTURE_SPECULAR );
+            textures.insert( textures.end( ), make_move_iterator( specularMaps.begin( ) ), make_move_iterator( specularMaps.end( ) ) );
+        }
+        
+        // Weld and reorder for the post-transform vertex cache and overdraw, the result is what gets cached
+        MeshOptStats stats = MeshOptimizer::Optimize( vertices, indices );
+        printf( "MESHOPT:: %s mesh %u: %u tris, verts %u -> %u, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+                this->directory.c_str( ), ( unsigned )this->meshes.size( ), stats.triangles, stats.verticesBefore, stats.verticesAfter,
+                stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter );
+        
+        // The bounding sphere is centred on the box, its radius reaches the farthest vertex
+        glm::vec3 boundsCenter = ( boundsMin + boundsMax ) * 0.5f;
+        GLfloat boundsRadius = 0.0f;
+        for ( GLuint i = 0; i < vertices.size( ); i++ )
+        {
+            boundsRadius = glm::max( boundsRadius, glm::length( vertices[i].Position - boundsCenter ) );
+        }
+        
+        // Coarser levels over the optimized vertices, cached with them
+        vector<GLuint> lodIndices;
+        vector<MeshLod> lods;
+        MeshOptimizer::BuildLods( vertices, indices, boundsRadius, lodIndices, lods );
+        printf( "LOD:: %s mesh %u: %u tris", this->directory.c_str( ), ( unsigned )this->meshes.size( ), stats.triangles );
+        for ( GLuint i = 0; i < lods.size( ); i++ )
+        {
+            printf( " -> %u (error %.4f)", lods[i].indexCount / 3, lods[i].error );
         }
+        printf( "\n" );
         
-        // Return a mesh object created from the extracted mesh data
-        return Mesh( vertices, indices, textures );
+        // Return a mesh object created from the extracted mesh data, moving the arrays in rather than copying them
+        IndexArray compactIndices( indices, vertices.size( ) );
+        IndexArray compactLodIndices( lodIndices, vertices.size( ) );
+        Mesh result( std::move( vertices ), std::move( compactIndices ), std::move( textures ), boundsMin, boundsMax, boundsRadius,
+                     this->streams );
+        result.SetLods( std::move( compactLodIndices ), std::move( lods ) );
+        return result;
     }
     
     // Checks all material textures of a given type and loads the textures if they're not loaded yet.
     // The required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures( aiMaterial *mat, aiTextureType type, string typeName )
+    vector<Texture> loadMaterialTextures( aiMaterial *mat, aiTextureType type, TextureType typeName )
     {
         vector<Texture> textures;
         
@@ -176,61 +543,22 @@ private:
         {
             aiString str;
             mat->GetTexture( type, i, &str );
-            
-            // Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            GLboolean skip = false;
-            
-            for ( GLuint j = 0; j < textures_loaded.size( ); j++ )
-            {
-                if( textures_loaded[j].path == str )
-                {
-                    textures.push_back( textures_loaded[j] );
-                    skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    
-                    break;
-                }
-            }
-            
-            if( !skip )
-            {   // If texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile( str.C_Str( ), this->directory );
-                texture.type = typeName;
-                texture.path = str;
-                textures.push_back( texture );
-                
-                this->textures_loaded.push_back( texture );  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back( this->loadTexture( str.C_Str( ), typeName ) );
         }
         
         return textures;
     }
+    
+    // Returns the texture slot for a path relative to the model directory. The TextureRegistry makes sure each
+    // file is only loaded once across all models.
+    Texture loadTexture( const char *path, TextureType typeName )
+    {
+        Texture texture;
+        texture.handle = TextureRef( TextureRegistry::Instance( ).Acquire( this->directory + '/' + path ) );
+        texture.type = typeName;
+        
+        this->texturePaths[texture.handle] = path;
+        
+        return texture;
+    }
 };
-
-GLint TextureFromFile( const char *path, string directory )
-{
-    //Generate texture ID and load texture data
-    string filename = string( path );
-    filename = directory + '/' + filename;
-    GLuint textureID;
-    glGenTextures( 1, &textureID );
-    
-    int width, height;
-    
-    unsigned char *image = stbi_load( filename.c_str( ), &width, &height, 0, STBI_rgb);
-    
-    // Assign texture to ID
-    glBindTexture( GL_TEXTURE_2D, textureID );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
-    
-    // Parameters
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture( GL_TEXTURE_2D, 0 );
-	stbi_image_free( image );
-    
-    return textureID;
-}
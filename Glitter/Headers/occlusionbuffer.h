@@ -0,0 +1,491 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+#include "mesh.h"
+#include "model.h"
+#include "threadpool.h"
+
+using namespace std;
+
+// Resolution of the occlusion depth buffer. The width is a multiple of four, a row is filled four pixels at a time.
+const GLuint OCCLUSION_WIDTH = 256;
+const GLuint OCCLUSION_HEIGHT = 160;
+// Points with a clip w under this are treated as reaching behind the eye.
+const GLfloat OCCLUSION_NEAR_W = 1e-3f;
+
+// What the last frame rasterized and how many boxes it hid.
+struct OcclusionStats
+{
+    GLuint occluders;
+    GLuint triangles;
+    GLuint tested;
+    GLuint occluded;
+    double rasterSeconds;
+};
+
+/*  Software hierarchical Z: occluder meshes are rasterized on the CPU into a small depth buffer, then
+    boxes are tested against a min/max pyramid built over it. A box is hidden when, everywhere it covers,
+    some occluder is nearer than its nearest corner.
+
+    Rendering runs in two parallel passes on the buffer's own workers, the calling thread included: the
+    occluder triangles are transformed and set up in chunks, then every band of rows is cleared and filled
+    by one thread, four pixels per SSE step, so no two threads ever write the same pixel. Triangles that
+    reach behind the near plane are dropped rather than clipped; that can only hide less. Depths are NDC
+    depth mapped to [0, 1], interpolated linearly in screen space like the GPU does.
+
+    Coverage and depth are sampled at pixel centres, and one buffer pixel spans several screen pixels, so a
+    pixel whose centre an occluder covers may still show something past its silhouette. IsVisible makes up
+    for that by testing one pixel more on every side of a box: where a silhouette edge crosses a pixel, one
+    of the neighbouring centres lies past that edge and holds the depth behind it. What remains are
+    concave notches and gaps narrower than the sample spacing, which can hide a box for a pixel. */
+class OcclusionBuffer
+{
+public:
+    /*  Functions  */
+    // Constructor, threadCount is the threads rasterizing, the caller included; 0 for every hardware thread.
+    explicit OcclusionBuffer( unsigned threadCount = 0 )
+        : width( OCCLUSION_WIDTH ), height( OCCLUSION_HEIGHT ), batchCount( 0 ),
+          threadCount( threadCount == 0 ? std::max( thread::hardware_concurrency( ), 1u ) : threadCount )
+    {
+        this->depth.assign( this->width * this->height, 1.0f );
+
+        // Coarser levels halve both sides, for as long as both stay whole
+        GLuint levelWidth = this->width, levelHeight = this->height;
+        while( levelWidth % 2 == 0 && levelHeight % 2 == 0 && ( levelWidth > 1 || levelHeight > 1 ) )
+        {
+            levelWidth /= 2;
+            levelHeight /= 2;
+            this->nearest.push_back( vector<GLfloat>( levelWidth * levelHeight, 1.0f ) );
+            this->farthest.push_back( vector<GLfloat>( levelWidth * levelHeight, 1.0f ) );
+        }
+        this->resetStats( );
+    }
+
+    OcclusionBuffer( const OcclusionBuffer & ) = delete;
+    OcclusionBuffer &operator=( const OcclusionBuffer & ) = delete;
+
+    // Starts a frame seen through viewProjection, dropping the previous frame's occluders.
+    void Begin( const glm::mat4 &viewProjection )
+    {
+        this->viewProjection = viewProjection;
+        this->batchCount = 0;
+        this->resetStats( );
+    }
+
+    // Queues every mesh of model at level lod under transform as an occluder. Nothing is drawn until Render.
+    void AddOccluder( const Model &model, GLuint lod, const glm::mat4 &transform )
+    {
+        glm::mat4 toClip = this->viewProjection * transform;
+        const vector<Mesh> &meshes = model.Meshes( );
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            GLuint triangles = meshes[i].TriangleCount( lod );
+            for ( GLuint first = 0; first < triangles; first += SETUP_GRAIN )
+            {
+                if( this->batchCount == this->batches.size( ) )
+                {
+                    this->batches.push_back( OccluderBatch( ) );
+                }
+                OccluderBatch &batch = this->batches[this->batchCount++];
+                batch.mesh = &meshes[i];
+                batch.lod = lod;
+                batch.toClip = toClip;
+                batch.firstTriangle = first;
+                batch.triangleCount = std::min( SETUP_GRAIN, triangles - first );
+            }
+        }
+        this->stats.occluders++;
+    }
+
+    // Rasterizes the queued occluders and builds the pyramid the tests read.
+    void Render( )
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now( );
+
+        this->parallelFor( this->batchCount, [this]( GLuint batch )
+        {
+            this->setup( this->batches[batch] );
+        } );
+        for ( GLuint i = 0; i < this->batchCount; i++ )
+        {
+            this->stats.triangles += ( GLuint )this->batches[i].triangles.size( );
+        }
+
+        GLuint bands = ( this->height + BAND_ROWS - 1 ) / BAND_ROWS;
+        this->parallelFor( bands, [this]( GLuint band )
+        {
+            this->rasterizeBand( band * BAND_ROWS, std::min( ( band + 1 ) * BAND_ROWS, this->height ) );
+        } );
+
+        for ( GLuint level = 0; level < this->nearest.size( ); level++ )
+        {
+            GLuint rows = this->height >> ( level + 1 );
+            this->parallelFor( ( rows + BAND_ROWS - 1 ) / BAND_ROWS, [this, level, rows]( GLuint band )
+            {
+                this->reduce( level, band * BAND_ROWS, std::min( ( band + 1 ) * BAND_ROWS, rows ) );
+            } );
+        }
+
+        this->stats.rasterSeconds = chrono::duration<double>( chrono::steady_clock::now( ) - start ).count( );
+    }
+
+    // Whether any part of the object space box under transform may be seen past the occluders. Boxes that
+    // reach behind the near plane or off screen count as visible, the frustum is someone else's job.
+    bool IsVisible( glm::vec3 boxMin, glm::vec3 boxMax, const glm::mat4 &transform )
+    {
+        this->stats.tested++;
+        glm::mat4 toClip = this->viewProjection * transform;
+        glm::vec3 low( 1.0f ), high( -1.0f );
+        for ( int corner = 0; corner < 8; corner++ )
+        {
+            glm::vec3 p( corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y, corner & 4 ? boxMax.z : boxMin.z );
+            glm::vec4 clip = toClip * glm::vec4( p, 1.0f );
+            if( clip.w <= OCCLUSION_NEAR_W )
+            {
+                return true;
+            }
+            glm::vec3 ndc = glm::vec3( clip ) / clip.w;
+            low = corner == 0 ? ndc : glm::min( low, ndc );
+            high = corner == 0 ? ndc : glm::max( high, ndc );
+        }
+
+        GLint x0 = ( GLint )floor( ( low.x * 0.5f + 0.5f ) * this->width );
+        GLint x1 = ( GLint )ceil( ( high.x * 0.5f + 0.5f ) * this->width ) - 1;
+        GLint y0 = ( GLint )floor( ( low.y * 0.5f + 0.5f ) * this->height );
+        GLint y1 = ( GLint )ceil( ( high.y * 0.5f + 0.5f ) * this->height ) - 1;
+        GLfloat boxDepth = low.z * 0.5f + 0.5f;
+        if( x1 < 0 || y1 < 0 || x0 >= ( GLint )this->width || y0 >= ( GLint )this->height || boxDepth <= 0.0f )
+        {
+            return true;
+        }
+
+        // One more pixel each way, see the class comment
+        x0 = std::max( x0 - 1, 0 );
+        y0 = std::max( y0 - 1, 0 );
+        x1 = std::min( x1 + 1, ( GLint )this->width - 1 );
+        y1 = std::min( y1 + 1, ( GLint )this->height - 1 );
+
+        // Start at the finest level where the box covers at most two texels each way
+        GLuint level = 0;
+        while( level < this->nearest.size( ) && ( ( x1 >> level ) - ( x0 >> level ) > 1 || ( y1 >> level ) - ( y0 >> level ) > 1 ) )
+        {
+            level++;
+        }
+        if( this->visibleIn( level, x0 >> level, y0 >> level, x1 >> level, y1 >> level, x0, y0, x1, y1, boxDepth ) )
+        {
+            return true;
+        }
+        this->stats.occluded++;
+        return false;
+    }
+
+    const OcclusionStats &Stats( ) const
+    {
+        return this->stats;
+    }
+
+    GLuint Width( ) const
+    {
+        return this->width;
+    }
+
+    GLuint Height( ) const
+    {
+        return this->height;
+    }
+
+    // The full resolution depths, row by row from the bottom of the screen.
+    const vector<GLfloat> &Depth( ) const
+    {
+        return this->depth;
+    }
+
+private:
+    // Triangles set up per task, rows per raster task
+    static const GLuint SETUP_GRAIN = 1024;
+    static const GLuint BAND_ROWS = 8;
+
+    // A screen space triangle, counter-clockwise, with its edge and depth planes over pixel coordinates
+    struct OccluderTriangle
+    {
+        GLfloat edgeA[3], edgeB[3], edgeC[3];
+        GLfloat depthA, depthB, depthC;
+        GLint minX, maxX, minY, maxY;
+    };
+
+    // A run of one occluder mesh's triangles, set up by one task
+    struct OccluderBatch
+    {
+        const Mesh *mesh;
+        GLuint lod;
+        glm::mat4 toClip;
+        GLuint firstTriangle;
+        GLuint triangleCount;
+        vector<OccluderTriangle> triangles;
+    };
+
+    /*  Occlusion Data  */
+    GLuint width;
+    GLuint height;
+    vector<GLfloat> depth;
+    // Pyramid levels 1 and up, level 0 is depth itself
+    vector<vector<GLfloat> > nearest;
+    vector<vector<GLfloat> > farthest;
+    glm::mat4 viewProjection;
+    // Kept between frames with their triangle arrays, only the first batchCount are live
+    vector<OccluderBatch> batches;
+    GLuint batchCount;
+    unsigned threadCount;
+    unique_ptr<ThreadPool> workers;
+    OcclusionStats stats;
+
+    /*  Functions   */
+    void resetStats( )
+    {
+        this->stats.occluders = 0;
+        this->stats.triangles = 0;
+        this->stats.tested = 0;
+        this->stats.occluded = 0;
+        this->stats.rasterSeconds = 0.0;
+    }
+
+    // Calls body( i ) for every i below count, spread over the workers and the caller. Workers start on first use.
+    template <class Body>
+    void parallelFor( GLuint count, const Body &body )
+    {
+        if( this->threadCount > 1 && !this->workers )
+        {
+            this->workers.reset( new ThreadPool( this->threadCount - 1 ) );
+        }
+        GLuint helpers = this->workers ? std::min( this->workers->Size( ), count > 0 ? count - 1 : 0 ) : 0;
+
+        atomic<GLuint> next( 0 );
+        auto run = [&]( )
+        {
+            for ( GLuint i = next++; i < count; i = next++ )
+            {
+                body( i );
+            }
+        };
+
+        vector<future<void> > pending;
+        for ( GLuint i = 0; i < helpers; i++ )
+        {
+            pending.push_back( this->workers->Submit( run ) );
+        }
+        run( );
+        for ( size_t i = 0; i < pending.size( ); i++ )
+        {
+            pending[i].get( );
+        }
+    }
+
+    // Projects a batch's triangles and keeps the ones that land on screen, wound counter-clockwise
+    void setup( OccluderBatch &batch ) const
+    {
+        batch.triangles.clear( );
+        const Mesh &mesh = *batch.mesh;
+        bool full = batch.lod == 0 || mesh.lods.empty( );
+        const IndexArray &indices = full ? mesh.indices : mesh.lodIndices;
+        GLuint firstIndex = full ? 0 : mesh.lods[std::min( batch.lod, ( GLuint )mesh.lods.size( ) ) - 1].firstIndex;
+
+        for ( GLuint t = batch.firstTriangle; t < batch.firstTriangle + batch.triangleCount; t++ )
+        {
+            glm::vec3 screen[3];
+            bool behind = false;
+            for ( int k = 0; k < 3; k++ )
+            {
+                glm::vec4 clip = batch.toClip * glm::vec4( mesh.vertices[indices[firstIndex + t * 3 + k]].Position, 1.0f );
+                behind = behind || clip.w <= OCCLUSION_NEAR_W;
+                screen[k] = glm::vec3( ( clip.x / clip.w * 0.5f + 0.5f ) * this->width, ( clip.y / clip.w * 0.5f + 0.5f ) * this->height,
+                                       clip.z / clip.w * 0.5f + 0.5f );
+            }
+            if( behind )
+            {
+                continue;
+            }
+
+            GLfloat area = ( screen[1].x - screen[0].x ) * ( screen[2].y - screen[0].y ) - ( screen[2].x - screen[0].x ) * ( screen[1].y - screen[0].y );
+            if( area == 0.0f )
+            {
+                continue;
+            }
+            // Both windings occlude, the buffer has no idea which side of a mesh is its outside
+            if( area < 0.0f )
+            {
+                swap( screen[1], screen[2] );
+                area = -area;
+            }
+
+            OccluderTriangle triangle;
+            GLfloat minX = std::min( std::min( screen[0].x, screen[1].x ), screen[2].x );
+            GLfloat maxX = std::max( std::max( screen[0].x, screen[1].x ), screen[2].x );
+            GLfloat minY = std::min( std::min( screen[0].y, screen[1].y ), screen[2].y );
+            GLfloat maxY = std::max( std::max( screen[0].y, screen[1].y ), screen[2].y );
+            triangle.minX = std::max( ( GLint )floor( minX ), 0 );
+            triangle.maxX = std::min( ( GLint )ceil( maxX ), ( GLint )this->width - 1 );
+            triangle.minY = std::max( ( GLint )floor( minY ), 0 );
+            triangle.maxY = std::min( ( GLint )ceil( maxY ), ( GLint )this->height - 1 );
+            if( triangle.minX > triangle.maxX || triangle.minY > triangle.maxY )
+            {
+                continue;
+            }
+
+            // Edge k runs from corner k to the next, positive on the inside
+            for ( int k = 0; k < 3; k++ )
+            {
+                const glm::vec3 &a = screen[k], &b = screen[( k + 1 ) % 3];
+                triangle.edgeA[k] = a.y - b.y;
+                triangle.edgeB[k] = b.x - a.x;
+                triangle.edgeC[k] = a.x * b.y - a.y * b.x;
+            }
+
+            // Depth as a plane over x and y
+            glm::vec3 u = screen[1] - screen[0], v = screen[2] - screen[0];
+            triangle.depthA = ( u.z * v.y - v.z * u.y ) / area;
+            triangle.depthB = ( v.z * u.x - u.z * v.x ) / area;
+            triangle.depthC = screen[0].z - triangle.depthA * screen[0].x - triangle.depthB * screen[0].y;
+            batch.triangles.push_back( triangle );
+        }
+    }
+
+    // Clears rows [rowBegin, rowEnd) and draws every triangle crossing them, keeping the nearest depth
+    void rasterizeBand( GLuint rowBegin, GLuint rowEnd )
+    {
+        fill( this->depth.begin( ) + rowBegin * this->width, this->depth.begin( ) + rowEnd * this->width, 1.0f );
+
+        for ( GLuint b = 0; b < this->batchCount; b++ )
+        {
+            const vector<OccluderTriangle> &triangles = this->batches[b].triangles;
+            for ( size_t i = 0; i < triangles.size( ); i++ )
+            {
+                const OccluderTriangle &triangle = triangles[i];
+                GLint y0 = std::max( triangle.minY, ( GLint )rowBegin ), y1 = std::min( triangle.maxY, ( GLint )rowEnd - 1 );
+                for ( GLint y = y0; y <= y1; y++ )
+                {
+                    this->rasterizeRow( triangle, y );
+                }
+            }
+        }
+    }
+
+    // Samples at pixel centres; four at a time with SSE, from the multiple of four at or before minX
+    void rasterizeRow( const OccluderTriangle &triangle, GLint y )
+    {
+        GLfloat centerY = y + 0.5f;
+        GLfloat *row = &this->depth[y * this->width];
+#ifdef OCCLUSION_SSE
+        __m128 rowEdge[3], stepEdge[3];
+        for ( int k = 0; k < 3; k++ )
+        {
+            rowEdge[k] = _mm_set1_ps( triangle.edgeB[k] * centerY + triangle.edgeC[k] );
+            stepEdge[k] = _mm_set1_ps( triangle.edgeA[k] );
+        }
+        __m128 rowDepth = _mm_set1_ps( triangle.depthB * centerY + triangle.depthC );
+        __m128 stepDepth = _mm_set1_ps( triangle.depthA );
+        const __m128 zero = _mm_setzero_ps( );
+        const __m128 lanes = _mm_setr_ps( 0.5f, 1.5f, 2.5f, 3.5f );
+
+        for ( GLint x = triangle.minX & ~3; x <= triangle.maxX; x += 4 )
+        {
+            __m128 centerX = _mm_add_ps( _mm_set1_ps( ( GLfloat )x ), lanes );
+            __m128 inside = _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( stepEdge[0], centerX ), rowEdge[0] ), zero );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( stepEdge[1], centerX ), rowEdge[1] ), zero ) );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( stepEdge[2], centerX ), rowEdge[2] ), zero ) );
+            if( _mm_movemask_ps( inside ) == 0 )
+            {
+                continue;
+            }
+
+            __m128 stored = _mm_loadu_ps( row + x );
+            __m128 nearer = _mm_min_ps( stored, _mm_add_ps( _mm_mul_ps( stepDepth, centerX ), rowDepth ) );
+            _mm_storeu_ps( row + x, _mm_or_ps( _mm_and_ps( inside, nearer ), _mm_andnot_ps( inside, stored ) ) );
+        }
+#else
+        for ( GLint x = triangle.minX; x <= triangle.maxX; x++ )
+        {
+            GLfloat centerX = x + 0.5f;
+            bool inside = true;
+            for ( int k = 0; k < 3; k++ )
+            {
+                inside = inside && triangle.edgeA[k] * centerX + triangle.edgeB[k] * centerY + triangle.edgeC[k] >= 0.0f;
+            }
+            if( inside )
+            {
+                row[x] = std::min( row[x], triangle.depthA * centerX + triangle.depthB * centerY + triangle.depthC );
+            }
+        }
+#endif
+    }
+
+    // Fills rows [rowBegin, rowEnd) of pyramid level + 1 from the level below it
+    void reduce( GLuint level, GLuint rowBegin, GLuint rowEnd )
+    {
+        GLuint sourceWidth = this->width >> level, targetWidth = sourceWidth / 2;
+        const GLfloat *sourceNear = level == 0 ? &this->depth[0] : &this->nearest[level - 1][0];
+        const GLfloat *sourceFar = level == 0 ? &this->depth[0] : &this->farthest[level - 1][0];
+        GLfloat *targetNear = &this->nearest[level][0], *targetFar = &this->farthest[level][0];
+        for ( GLuint y = rowBegin; y < rowEnd; y++ )
+        {
+            for ( GLuint x = 0; x < targetWidth; x++ )
+            {
+                GLuint a = ( y * 2 ) * sourceWidth + x * 2, b = a + sourceWidth;
+                targetNear[y * targetWidth + x] = std::min( std::min( sourceNear[a], sourceNear[a + 1] ), std::min( sourceNear[b], sourceNear[b + 1] ) );
+                targetFar[y * targetWidth + x] = std::max( std::max( sourceFar[a], sourceFar[a + 1] ), std::max( sourceFar[b], sourceFar[b + 1] ) );
+            }
+        }
+    }
+
+    // Whether boxDepth is in front of anything in texels [tx0, tx1] x [ty0, ty1] of level, which lie inside the
+    // box's pixel rectangle [x0, x1] x [y0, y1]. Texels whose depths straddle the box are refined one level down.
+    bool visibleIn( GLuint level, GLint tx0, GLint ty0, GLint tx1, GLint ty1, GLint x0, GLint y0, GLint x1, GLint y1, GLfloat boxDepth ) const
+    {
+        for ( GLint ty = ty0; ty <= ty1; ty++ )
+        {
+            for ( GLint tx = tx0; tx <= tx1; tx++ )
+            {
+                if( level == 0 )
+                {
+                    if( boxDepth <= this->depth[ty * this->width + tx] )
+                    {
+                        return true;
+                    }
+                    continue;
+                }
+
+                GLuint texel = ty * ( this->width >> level ) + tx;
+                if( boxDepth > this->farthest[level - 1][texel] )
+                {
+                    continue;
+                }
+                if( boxDepth <= this->nearest[level - 1][texel] )
+                {
+                    return true;
+                }
+                GLuint child = level - 1;
+                if( this->visibleIn( child, std::max( tx * 2, x0 >> child ), std::max( ty * 2, y0 >> child ),
+                                     std::min( tx * 2 + 1, x1 >> child ), std::min( ty * 2 + 1, y1 >> child ), x0, y0, x1, y1, boxDepth ) )
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
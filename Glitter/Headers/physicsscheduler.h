@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletDynamics/Dynamics/btSimulationIslandManagerMt.h>
+#include <LinearMath/btThreads.h>
+
+#include "threadpool.h"
+
+using namespace std;
+
+// Needs a Bullet built with BULLET2_USE_THREAD_LOCKS, its spin locks and thread indices are stubs otherwise
+#if BT_THREADSAFE
+
+/*  Runs the parallel parts of a Bullet step on our own worker threads. The vendored Bullet predates its
+    task scheduler interface, its multithreaded world only takes an island dispatch function, so this is
+    that function plus the parallel-for behind it. The thread calling stepSimulation takes part in every
+    loop, a thread count of N means N - 1 workers.
+
+    Bullet's dispatch hook is a plain function pointer, hence the single process-wide instance. */
+class PhysicsScheduler
+{
+public:
+    /*  Functions  */
+    static PhysicsScheduler &Instance( )
+    {
+        static PhysicsScheduler scheduler;
+        return scheduler;
+    }
+
+    // Threads working on each step, the caller included; 0 uses every hardware thread. Not while a world is stepping.
+    void SetThreadCount( unsigned threadCount )
+    {
+        if( threadCount == 0 )
+        {
+            threadCount = std::max( thread::hardware_concurrency( ), 1u );
+        }
+        threadCount = std::min( threadCount, ( unsigned )BT_MAX_THREAD_COUNT );
+        if( threadCount == this->ThreadCount( ) )
+        {
+            return;
+        }
+        this->workers.reset( threadCount > 1 ? new ThreadPool( threadCount - 1 ) : nullptr );
+    }
+
+    unsigned ThreadCount( ) const
+    {
+        return this->workers ? this->workers->Size( ) + 1 : 1;
+    }
+
+    // Calls body( first, last ) over [begin, end) in chunks of grain, spread over the workers and the caller.
+    template <class Body>
+    void ParallelFor( int begin, int end, int grain, const Body &body )
+    {
+        int chunks = ( end - begin + grain - 1 ) / grain;
+        unsigned helpers = this->workers ? std::min( this->workers->Size( ), ( unsigned )std::max( chunks - 1, 0 ) ) : 0;
+        if( helpers == 0 )
+        {
+            if( end > begin )
+            {
+                body( begin, end );
+            }
+            return;
+        }
+
+        // Every thread takes the next chunk until none are left, so uneven chunks balance out
+        atomic<int> next( begin );
+        auto run = [&]( )
+        {
+            for ( ;; )
+            {
+                int first = next.fetch_add( grain );
+                if( first >= end )
+                {
+                    return;
+                }
+                body( first, std::min( first + grain, end ) );
+            }
+        };
+
+        vector<future<void> > pending;
+        pending.reserve( helpers );
+        for ( unsigned i = 0; i < helpers; i++ )
+        {
+            pending.push_back( this->workers->Submit( run ) );
+        }
+        run( );
+        for ( size_t i = 0; i < pending.size( ); i++ )
+        {
+            pending[i].get( );
+        }
+    }
+
+    // btSimulationIslandManagerMt::IslandDispatchFunc, one island per chunk.
+    static void DispatchIslands( btAlignedObjectArray<btSimulationIslandManagerMt::Island *> *islands,
+                                 btSimulationIslandManagerMt::IslandCallback *callback )
+    {
+        PhysicsScheduler::Instance( ).ParallelFor( 0, islands->size( ), 1, [islands, callback]( int first, int last )
+        {
+            for ( int i = first; i < last; i++ )
+            {
+                btSimulationIslandManagerMt::Island *island = ( *islands )[i];
+                btPersistentManifold **manifolds = island->manifoldArray.size( ) ? &island->manifoldArray[0] : NULL;
+                btTypedConstraint **constraints = island->constraintArray.size( ) ? &island->constraintArray[0] : NULL;
+                callback->processIsland( &island->bodyArray[0], island->bodyArray.size( ), manifolds, island->manifoldArray.size( ),
+                                         constraints, island->constraintArray.size( ), island->id );
+            }
+        } );
+    }
+
+private:
+    /*  Scheduler Data  */
+    unique_ptr<ThreadPool> workers;
+
+    PhysicsScheduler( )
+    {
+    }
+    PhysicsScheduler( const PhysicsScheduler & ) = delete;
+    PhysicsScheduler &operator=( const PhysicsScheduler & ) = delete;
+};
+
+/*  A constraint solver that is really one btSequentialImpulseConstraintSolver per thread: islands are solved
+    concurrently and a solver keeps scratch state while it works. solveGroup takes whichever one is free. */
+class ConstraintSolverPool : public btConstraintSolver
+{
+public:
+    /*  Functions  */
+    explicit ConstraintSolverPool( unsigned count )
+        : solvers( count )
+    {
+        for ( unsigned i = 0; i < count; i++ )
+        {
+            this->solvers[i].solver.reset( new btSequentialImpulseConstraintSolver( ) );
+        }
+    }
+
+    virtual btScalar solveGroup( btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds,
+                                 btTypedConstraint **constraints, int numConstraints, const btContactSolverInfo &info,
+                                 btIDebugDraw *debugDrawer, btDispatcher *dispatcher )
+    {
+        Slot &slot = this->lockFree( );
+        slot.solver->solveGroup( bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, info, debugDrawer, dispatcher );
+        slot.lock.unlock( );
+        return 0.0f;
+    }
+
+    virtual void reset( )
+    {
+        for ( size_t i = 0; i < this->solvers.size( ); i++ )
+        {
+            this->solvers[i].solver->reset( );
+        }
+    }
+
+    virtual btConstraintSolverType getSolverType( ) const
+    {
+        return BT_SEQUENTIAL_IMPULSE_SOLVER;
+    }
+
+private:
+    // Padded to a cache line so threads spinning on neighbouring locks don't share one
+    struct Slot
+    {
+        unique_ptr<btSequentialImpulseConstraintSolver> solver;
+        btSpinMutex lock;
+        char padding[64 - sizeof( void * ) - sizeof( btSpinMutex )];
+    };
+
+    /*  Pool Data  */
+    vector<Slot> solvers;
+
+    /*  Functions   */
+    // There is a solver per thread, so this only spins when a thread count changed under a live world
+    Slot &lockFree( )
+    {
+        for ( ;; )
+        {
+            for ( size_t i = 0; i < this->solvers.size( ); i++ )
+            {
+                if( this->solvers[i].lock.tryLock( ) )
+                {
+                    return this->solvers[i];
+                }
+            }
+        }
+    }
+};
+
+/*  btDiscreteDynamicsWorldMt solves islands in parallel; this also spreads the two per-body loops of a step,
+    velocity prediction and transform integration, over the PhysicsScheduler. Collision detection stays
+    on the stepping thread, the stock dispatcher isn't safe to share. */
+ATTRIBUTE_ALIGNED16( class ) ParallelDynamicsWorld : public btDiscreteDynamicsWorldMt
+{
+public:
+    BT_DECLARE_ALIGNED_ALLOCATOR( );
+
+    /*  Functions  */
+    ParallelDynamicsWorld( btDispatcher *dispatcher, btBroadphaseInterface *broadphase, btConstraintSolver *solver,
+                           btCollisionConfiguration *configuration )
+        : btDiscreteDynamicsWorldMt( dispatcher, broadphase, solver, configuration )
+    {
+        btSimulationIslandManagerMt *islands = static_cast<btSimulationIslandManagerMt *>( this->getSimulationIslandManager( ) );
+        islands->setIslandDispatchFunction( PhysicsScheduler::DispatchIslands );
+    }
+
+protected:
+    // Bodies per chunk of the per-body loops
+    static const int BODY_GRAIN = 64;
+
+    virtual void predictUnconstraintMotion( btScalar timeStep )
+    {
+        btRigidBody **bodies = this->m_nonStaticRigidBodies.size( ) ? &this->m_nonStaticRigidBodies[0] : NULL;
+        PhysicsScheduler::Instance( ).ParallelFor( 0, this->m_nonStaticRigidBodies.size( ), int( BODY_GRAIN ), [bodies, timeStep]( int first, int last )
+        {
+            for ( int i = first; i < last; i++ )
+            {
+                // Velocities are integrated by the solver, only damping and the predicted transform happen here
+                if( !bodies[i]->isStaticOrKinematicObject( ) )
+                {
+                    bodies[i]->applyDamping( timeStep );
+                    bodies[i]->predictIntegratedTransform( timeStep, bodies[i]->getInterpolationWorldTransform( ) );
+                }
+            }
+        } );
+    }
+
+    virtual void integrateTransforms( btScalar timeStep )
+    {
+        // Restitution on predictive contacts runs after the integration and is serial, leave it to Bullet
+        if( this->m_applySpeculativeContactRestitution )
+        {
+            btDiscreteDynamicsWorldMt::integrateTransforms( timeStep );
+            return;
+        }
+
+        btRigidBody **bodies = this->m_nonStaticRigidBodies.size( ) ? &this->m_nonStaticRigidBodies[0] : NULL;
+        PhysicsScheduler::Instance( ).ParallelFor( 0, this->m_nonStaticRigidBodies.size( ), int( BODY_GRAIN ), [this, bodies, timeStep]( int first, int last )
+        {
+            this->integrateTransformsInternal( &bodies[first], last - first, timeStep );
+        } );
+    }
+};
+
+#endif // BT_THREADSAFE
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "collisionhull.h"
+#include "collisionmesh.h"
+#include "model.h"
+#include "physicsscheduler.h"
+
+using namespace std;
+
+// Collision filter groups, rays pick what they can hit by mask.
+enum PhysicsGroup
+{
+    PHYSICS_STATIC = 1 << 0,
+    PHYSICS_TARGET = 1 << 1,
+    PHYSICS_TERRAIN = 1 << 2,
+    PHYSICS_QUERY = PHYSICS_STATIC | PHYSICS_TARGET | PHYSICS_TERRAIN
+};
+
+// Index of a body in the world, in the order it was added.
+typedef GLint BodyId;
+
+// The first body a ray hit; body is -1 when nothing was hit.
+struct RayHit
+{
+    BodyId body;
+    glm::vec3 point;
+    glm::vec3 normal;
+    GLfloat distance;
+};
+
+/*  Collision world for the scene on Bullet: a btDiscreteDynamicsWorld over a btDbvtBroadphase. Bodies are
+    registered from a Model's bounds, convex hulls or triangles under the transform it is drawn with, scale
+    included, so the shapes line up with what is on screen. Static bodies never move; kinematic ones are moved by
+    SetTransform and pushed to the broadphase at once, so a ray cast in the same frame sees them.
+
+    With more than one thread the world is a ParallelDynamicsWorld stepping on the PhysicsScheduler. That
+    takes a Bullet built with BULLET2_USE_THREAD_LOCKS (BT_THREADSAFE); without it every world is serial. */
+class PhysicsWorld
+{
+public:
+    /*  Functions  */
+    // Constructor, threadCount is the threads stepping the world, 0 for every hardware thread.
+    explicit PhysicsWorld( unsigned threadCount = 1 )
+        : configuration( new btDefaultCollisionConfiguration( ) ),
+          dispatcher( new btCollisionDispatcher( configuration.get( ) ) ),
+          broadphase( new btDbvtBroadphase( ) ),
+          threadCount( 1 )
+    {
+#if BT_THREADSAFE
+        if( threadCount != 1 )
+        {
+            // One solver per thread, islands are solved side by side
+            PhysicsScheduler &scheduler = PhysicsScheduler::Instance( );
+            scheduler.SetThreadCount( threadCount );
+            this->threadCount = scheduler.ThreadCount( );
+            this->solver.reset( new ConstraintSolverPool( this->threadCount ) );
+            this->world.reset( new ParallelDynamicsWorld( this->dispatcher.get( ), this->broadphase.get( ), this->solver.get( ), this->configuration.get( ) ) );
+        }
+#else
+        ( void )threadCount;
+#endif
+        if( !this->world )
+        {
+            this->solver.reset( new btSequentialImpulseConstraintSolver( ) );
+            this->world.reset( new btDiscreteDynamicsWorld( this->dispatcher.get( ), this->broadphase.get( ), this->solver.get( ), this->configuration.get( ) ) );
+        }
+        this->world->setGravity( btVector3( 0.0f, -9.81f, 0.0f ) );
+    }
+
+    // The world refers to every body, they leave it before anything is freed
+    ~PhysicsWorld( )
+    {
+        for ( size_t i = 0; i < this->bodies.size( ); i++ )
+        {
+            if( this->bodies[i].enabled )
+            {
+                this->world->removeRigidBody( this->bodies[i].body.get( ) );
+            }
+        }
+    }
+
+    PhysicsWorld( const PhysicsWorld & ) = delete;
+    PhysicsWorld &operator=( const PhysicsWorld & ) = delete;
+
+    // A body that never moves, such as the tower or the terrain.
+    BodyId AddStatic( const Model &model, const glm::mat4 &transform, PhysicsGroup group = PHYSICS_STATIC )
+    {
+        return this->add( model.BoundsCenter( ), ( model.BoundsMax( ) - model.BoundsMin( ) ) * 0.5f, transform, 0.0f, group, false );
+    }
+
+    // A body moved by the game through SetTransform, such as a target.
+    BodyId AddKinematic( const Model &model, const glm::mat4 &transform, PhysicsGroup group = PHYSICS_TARGET )
+    {
+        return this->add( model.BoundsCenter( ), ( model.BoundsMax( ) - model.BoundsMin( ) ) * 0.5f, transform, 0.0f, group, true );
+    }
+
+    // A static triangle mesh under transform. The CollisionMesh is shared, not copied, and has to outlive the body.
+    BodyId AddMesh( const CollisionMesh &mesh, const glm::mat4 &transform, PhysicsGroup group = PHYSICS_STATIC )
+    {
+        Body body;
+        btVector3 scale;
+        btTransform pose = PhysicsWorld::toBullet( transform, scale );
+        body.shape.reset( new btScaledBvhTriangleMeshShape( mesh.Shape( ), scale ) );
+        return this->addBody( body, pose, 0.0f, group, false );
+    }
+
+    // The convex hulls of a model as one compound body, static or moved through SetTransform. The hull points are copied.
+    BodyId AddHull( const CollisionHull &hull, const glm::mat4 &transform, PhysicsGroup group, bool kinematic )
+    {
+        Body body;
+        btCompoundShape *compound = new btCompoundShape( false );
+        body.shape.reset( compound );
+        const vector<vector<glm::vec3> > &parts = hull.Parts( );
+        for ( size_t i = 0; i < parts.size( ); i++ )
+        {
+            if( parts[i].empty( ) )
+            {
+                continue;
+            }
+            btConvexHullShape *part = new btConvexHullShape( &parts[i][0].x, ( int )parts[i].size( ), sizeof( glm::vec3 ) );
+            body.children.push_back( unique_ptr<btCollisionShape>( part ) );
+            compound->addChildShape( btTransform::getIdentity( ), part );
+        }
+
+        btVector3 scale;
+        btTransform pose = PhysicsWorld::toBullet( transform, scale );
+        body.shape->setLocalScaling( scale );
+        return this->addBody( body, pose, 0.0f, group, kinematic );
+    }
+
+    // An object space box under transform, moved by the simulation when mass is above 0 and static otherwise.
+    BodyId AddBox( glm::vec3 center, glm::vec3 halfExtents, const glm::mat4 &transform, GLfloat mass, PhysicsGroup group )
+    {
+        return this->add( center, halfExtents, transform, mass, group, false );
+    }
+
+    // Moves a body to the transform its model is drawn with.
+    void SetTransform( BodyId id, const glm::mat4 &transform )
+    {
+        Body &body = this->bodies[id];
+        btVector3 scale;
+        btTransform pose = PhysicsWorld::toBullet( transform, scale );
+        body.body->setWorldTransform( pose );
+        body.motion->setWorldTransform( pose );
+        if( !( body.shape->getLocalScaling( ) == scale ) )
+        {
+            body.shape->setLocalScaling( scale );
+        }
+        if( body.enabled )
+        {
+            this->world->updateSingleAabb( body.body.get( ) );
+        }
+    }
+
+    // Takes a body out of every query and collision, or puts it back.
+    void SetEnabled( BodyId id, bool enabled )
+    {
+        Body &body = this->bodies[id];
+        if( body.enabled == enabled )
+        {
+            return;
+        }
+        if( enabled )
+        {
+            this->world->addRigidBody( body.body.get( ), ( short )body.group, ( short )PHYSICS_QUERY );
+        }
+        else
+        {
+            this->world->removeRigidBody( body.body.get( ) );
+        }
+        body.enabled = enabled;
+    }
+
+    // Advances the simulation by seconds in substeps of fixedStep, at most maxSubSteps of them.
+    void Step( GLfloat seconds, int maxSubSteps = 4, GLfloat fixedStep = 1.0f / 60.0f )
+    {
+        this->world->stepSimulation( seconds, maxSubSteps, fixedStep );
+    }
+
+    // Nearest body of a group in mask between from and to, through btCollisionWorld::rayTest.
+    bool RayTest( glm::vec3 from, glm::vec3 to, RayHit &hit, short mask = PHYSICS_QUERY ) const
+    {
+        btVector3 rayFrom( from.x, from.y, from.z ), rayTo( to.x, to.y, to.z );
+        btCollisionWorld::ClosestRayResultCallback callback( rayFrom, rayTo );
+        callback.m_collisionFilterGroup = btBroadphaseProxy::AllFilter;
+        callback.m_collisionFilterMask = mask;
+        this->world->rayTest( rayFrom, rayTo, callback );
+
+        hit.body = -1;
+        if( !callback.hasHit( ) )
+        {
+            return false;
+        }
+        hit.body = callback.m_collisionObject->getUserIndex( );
+        hit.point = glm::vec3( callback.m_hitPointWorld.x( ), callback.m_hitPointWorld.y( ), callback.m_hitPointWorld.z( ) );
+        hit.normal = glm::vec3( callback.m_hitNormalWorld.x( ), callback.m_hitNormalWorld.y( ), callback.m_hitNormalWorld.z( ) );
+        hit.distance = callback.m_closestHitFraction * glm::length( to - from );
+        return true;
+    }
+
+    // Whether target can be seen from eye: the first thing along the ray to its centre is the target itself.
+    bool LineOfSight( glm::vec3 eye, BodyId target, short mask = PHYSICS_QUERY ) const
+    {
+        btVector3 low, high;
+        this->bodies[target].body->getAabb( low, high );
+        btVector3 center = ( low + high ) * 0.5f;
+        RayHit hit;
+        return this->RayTest( eye, glm::vec3( center.x( ), center.y( ), center.z( ) ), hit, mask ) && hit.body == target;
+    }
+
+    GLuint BodyCount( ) const
+    {
+        return ( GLuint )this->bodies.size( );
+    }
+
+    unsigned ThreadCount( ) const
+    {
+        return this->threadCount;
+    }
+
+    btDiscreteDynamicsWorld &World( )
+    {
+        return *this->world;
+    }
+
+private:
+    struct Body
+    {
+        unique_ptr<btCollisionShape> shape;
+        // What a compound shape wraps, when it is one
+        vector<unique_ptr<btCollisionShape> > children;
+        unique_ptr<btDefaultMotionState> motion;
+        unique_ptr<btRigidBody> body;
+        PhysicsGroup group;
+        bool enabled;
+    };
+
+    /*  Physics Data  */
+    // Declared in construction order, the world goes first on destruction
+    unique_ptr<btDefaultCollisionConfiguration> configuration;
+    unique_ptr<btCollisionDispatcher> dispatcher;
+    unique_ptr<btDbvtBroadphase> broadphase;
+    unique_ptr<btConstraintSolver> solver;
+    unique_ptr<btDiscreteDynamicsWorld> world;
+    vector<Body> bodies;
+    unsigned threadCount;
+
+    /*  Functions   */
+    // A box offset to center, for models that is the centre of their bounds: their origins sit at the feet, not the middle.
+    BodyId add( glm::vec3 center, glm::vec3 halfExtents, const glm::mat4 &transform, GLfloat mass, PhysicsGroup group, bool kinematic )
+    {
+        Body body;
+        btCompoundShape *compound = new btCompoundShape( false );
+        body.shape.reset( compound );
+        btBoxShape *box = new btBoxShape( btVector3( halfExtents.x, halfExtents.y, halfExtents.z ) );
+        body.children.push_back( unique_ptr<btCollisionShape>( box ) );
+        compound->addChildShape( btTransform( btQuaternion::getIdentity( ), btVector3( center.x, center.y, center.z ) ), box );
+
+        // The compound carries the scale, it scales the child offset along with the box
+        btVector3 scale;
+        btTransform pose = PhysicsWorld::toBullet( transform, scale );
+        body.shape->setLocalScaling( scale );
+        return this->addBody( body, pose, mass, group, kinematic );
+    }
+
+    // Puts a body with its shape filled in into the world at pose.
+    BodyId addBody( Body &body, const btTransform &pose, GLfloat mass, PhysicsGroup group, bool kinematic )
+    {
+        body.motion.reset( new btDefaultMotionState( pose ) );
+
+        // Zero mass: static and kinematic bodies push others but are never pushed
+        btVector3 inertia( 0.0f, 0.0f, 0.0f );
+        if( mass > 0.0f )
+        {
+            body.shape->calculateLocalInertia( mass, inertia );
+        }
+        btRigidBody::btRigidBodyConstructionInfo info( mass, body.motion.get( ), body.shape.get( ), inertia );
+        body.body.reset( new btRigidBody( info ) );
+        if( kinematic )
+        {
+            body.body->setCollisionFlags( body.body->getCollisionFlags( ) | btCollisionObject::CF_KINEMATIC_OBJECT );
+            body.body->setActivationState( DISABLE_DEACTIVATION );
+        }
+
+        BodyId id = ( BodyId )this->bodies.size( );
+        body.body->setUserIndex( id );
+        body.group = group;
+        body.enabled = true;
+        this->world->addRigidBody( body.body.get( ), ( short )group, ( short )PHYSICS_QUERY );
+        this->bodies.push_back( std::move( body ) );
+        return id;
+    }
+
+    // Splits a model matrix into a rigid transform and the scale along its axes, Bullet keeps scale on the shape.
+    static btTransform toBullet( const glm::mat4 &transform, btVector3 &scale )
+    {
+        glm::vec3 axes[3];
+        for ( int i = 0; i < 3; i++ )
+        {
+            axes[i] = glm::vec3( transform[i] );
+            scale[i] = glm::length( axes[i] );
+            axes[i] /= scale[i];
+        }
+        btMatrix3x3 basis( axes[0].x, axes[1].x, axes[2].x,
+                           axes[0].y, axes[1].y, axes[2].y,
+                           axes[0].z, axes[1].z, axes[2].z );
+        return btTransform( basis, btVector3( transform[3].x, transform[3].y, transform[3].z ) );
+    }
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define PICKING_SSE 1
+#endif
+
+using namespace std;
+
+// The box a ray hit first, index is the order it was added in; -1 when nothing was hit.
+struct PickHit
+{
+    GLint index;
+    GLfloat distance;
+};
+
+/*  Ray picking against oriented boxes, stored structure-of-arrays so one ray is tested against four boxes
+    per SSE instruction. A box is an object space min/max under a transform whose first three columns are
+    the box axes and fourth its position, the same convention as the slab test in main.cpp. Pick returns
+    the nearest hit rather than the first one in insertion order. */
+class OBBPicker
+{
+public:
+    /*  Functions  */
+    explicit OBBPicker( size_t capacity = 16 )
+    {
+        for ( int i = 0; i < FIELD_COUNT; i++ )
+        {
+            this->fields[i].reserve( capacity + 3 );
+        }
+        this->count = 0;
+    }
+
+    void Clear( )
+    {
+        for ( int i = 0; i < FIELD_COUNT; i++ )
+        {
+            this->fields[i].clear( );
+        }
+        this->count = 0;
+    }
+
+    // Adds a box, returns its index in PickHit.
+    GLuint Add( const glm::mat4 &transform, glm::vec3 boxMin, glm::vec3 boxMax )
+    {
+        // Anything added after a Pick replaces the padding
+        this->trim( );
+
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            this->fields[POSITION_X + axis].push_back( transform[3][axis] );
+            this->fields[BOX_MIN_X + axis].push_back( boxMin[axis] );
+            this->fields[BOX_MAX_X + axis].push_back( boxMax[axis] );
+            for ( int component = 0; component < 3; component++ )
+            {
+                this->fields[AXIS_X_X + axis * 3 + component].push_back( transform[axis][component] );
+            }
+        }
+        return this->count++;
+    }
+
+    GLuint Count( ) const
+    {
+        return this->count;
+    }
+
+    // Nearest box along the ray within maxDistance. direction has to be normalized.
+    PickHit Pick( glm::vec3 origin, glm::vec3 direction, GLfloat maxDistance = 100.0f )
+    {
+        this->pad( );
+
+        PickHit hit;
+        hit.index = -1;
+        hit.distance = maxDistance;
+
+#ifdef PICKING_SSE
+        const __m128 zero = _mm_setzero_ps( );
+        const __m128 allOnes = _mm_cmpeq_ps( zero, zero );
+        const __m128 epsilon = _mm_set1_ps( 0.001f );
+        const __m128 signBit = _mm_set1_ps( -0.0f );
+        const __m128 ox = _mm_set1_ps( origin.x ), oy = _mm_set1_ps( origin.y ), oz = _mm_set1_ps( origin.z );
+        const __m128 dx = _mm_set1_ps( direction.x ), dy = _mm_set1_ps( direction.y ), dz = _mm_set1_ps( direction.z );
+
+        __m128 bestDistance = _mm_set1_ps( FLT_MAX );
+        __m128i bestIndex = _mm_set1_epi32( -1 );
+        __m128i lane = _mm_setr_epi32( 0, 1, 2, 3 );
+
+        size_t padded = this->fields[0].size( );
+        for ( size_t i = 0; i < padded; i += 4, lane = _mm_add_epi32( lane, _mm_set1_epi32( 4 ) ) )
+        {
+            __m128 deltaX = _mm_sub_ps( this->load( POSITION_X, i ), ox );
+            __m128 deltaY = _mm_sub_ps( this->load( POSITION_Y, i ), oy );
+            __m128 deltaZ = _mm_sub_ps( this->load( POSITION_Z, i ), oz );
+
+            __m128 tMin = zero;
+            __m128 tMax = _mm_set1_ps( maxDistance );
+            __m128 valid = allOnes;
+
+            for ( int axis = 0; axis < 3; axis++ )
+            {
+                __m128 ax = this->load( AXIS_X_X + axis * 3, i );
+                __m128 ay = this->load( AXIS_X_X + axis * 3 + 1, i );
+                __m128 az = this->load( AXIS_X_X + axis * 3 + 2, i );
+                __m128 low = this->load( BOX_MIN_X + axis, i );
+                __m128 high = this->load( BOX_MAX_X + axis, i );
+
+                __m128 e = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, deltaX ), _mm_mul_ps( ay, deltaY ) ), _mm_mul_ps( az, deltaZ ) );
+                __m128 f = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, dx ), _mm_mul_ps( ay, dy ) ), _mm_mul_ps( az, dz ) );
+
+                // Ray almost parallel to the slab: a hit only if the origin is between the planes
+                __m128 parallel = _mm_cmple_ps( _mm_andnot_ps( signBit, f ), epsilon );
+                __m128 inSlab = _mm_and_ps( _mm_cmple_ps( _mm_sub_ps( low, e ), zero ), _mm_cmpge_ps( _mm_sub_ps( high, e ), zero ) );
+                valid = _mm_and_ps( valid, _mm_or_ps( _mm_andnot_ps( parallel, allOnes ), inSlab ) );
+
+                // Otherwise clip [tMin, tMax] to the slab; parallel lanes keep their interval
+                __m128 t1 = _mm_div_ps( _mm_add_ps( e, low ), f );
+                __m128 t2 = _mm_div_ps( _mm_add_ps( e, high ), f );
+                __m128 clippedMin = _mm_max_ps( tMin, _mm_min_ps( t1, t2 ) );
+                __m128 clippedMax = _mm_min_ps( tMax, _mm_max_ps( t1, t2 ) );
+                tMin = _mm_or_ps( _mm_and_ps( parallel, tMin ), _mm_andnot_ps( parallel, clippedMin ) );
+                tMax = _mm_or_ps( _mm_and_ps( parallel, tMax ), _mm_andnot_ps( parallel, clippedMax ) );
+            }
+
+            __m128 closer = _mm_and_ps( _mm_and_ps( valid, _mm_cmple_ps( tMin, tMax ) ), _mm_cmplt_ps( tMin, bestDistance ) );
+            bestDistance = _mm_or_ps( _mm_and_ps( closer, tMin ), _mm_andnot_ps( closer, bestDistance ) );
+            __m128i closerInt = _mm_castps_si128( closer );
+            bestIndex = _mm_or_si128( _mm_and_si128( closerInt, lane ), _mm_andnot_si128( closerInt, bestIndex ) );
+        }
+
+        // Reduce the four lanes, ties go to the lower index
+        GLfloat distances[4];
+        GLint indices[4];
+        _mm_storeu_ps( distances, bestDistance );
+        _mm_storeu_si128( ( __m128i * )indices, bestIndex );
+        for ( int k = 0; k < 4; k++ )
+        {
+            if( indices[k] >= 0 && ( hit.index < 0 || distances[k] < hit.distance ||
+                                     ( distances[k] == hit.distance && indices[k] < hit.index ) ) )
+            {
+                hit.index = indices[k];
+                hit.distance = distances[k];
+            }
+        }
+#else
+        for ( GLuint i = 0; i < this->count; i++ )
+        {
+            GLfloat distance;
+            if( this->test( i, origin, direction, maxDistance, distance ) && ( hit.index < 0 || distance < hit.distance ) )
+            {
+                hit.index = ( GLint )i;
+                hit.distance = distance;
+            }
+        }
+#endif
+
+        return hit;
+    }
+
+private:
+    // One array per scalar of a box
+    enum Field
+    {
+        POSITION_X, POSITION_Y, POSITION_Z,
+        AXIS_X_X, AXIS_X_Y, AXIS_X_Z,
+        AXIS_Y_X, AXIS_Y_Y, AXIS_Y_Z,
+        AXIS_Z_X, AXIS_Z_Y, AXIS_Z_Z,
+        BOX_MIN_X, BOX_MIN_Y, BOX_MIN_Z,
+        BOX_MAX_X, BOX_MAX_Y, BOX_MAX_Z,
+        FIELD_COUNT
+    };
+
+    /*  Picker Data  */
+    vector<GLfloat> fields[FIELD_COUNT];
+    GLuint count;
+
+    /*  Functions   */
+    // Pads to a whole number of lanes with boxes no ray can hit: no axes, so every slab is parallel, and min > max
+    void pad( )
+    {
+        size_t padded = ( this->count + 3 ) & ~( size_t )3;
+        for ( int i = 0; i < FIELD_COUNT; i++ )
+        {
+            GLfloat filler = i >= BOX_MIN_X && i <= BOX_MIN_Z ? 1.0f : ( i >= BOX_MAX_X ? -1.0f : 0.0f );
+            this->fields[i].resize( padded, filler );
+        }
+    }
+
+    void trim( )
+    {
+        for ( int i = 0; i < FIELD_COUNT; i++ )
+        {
+            this->fields[i].resize( this->count );
+        }
+    }
+
+#ifdef PICKING_SSE
+    __m128 load( int field, size_t i ) const
+    {
+        return _mm_loadu_ps( &this->fields[field][i] );
+    }
+#else
+    // The slab test for one box
+    bool test( GLuint i, glm::vec3 origin, glm::vec3 direction, GLfloat maxDistance, GLfloat &distance ) const
+    {
+        GLfloat tMin = 0.0f, tMax = maxDistance;
+        glm::vec3 delta = glm::vec3( this->fields[POSITION_X][i], this->fields[POSITION_Y][i], this->fields[POSITION_Z][i] ) - origin;
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            glm::vec3 a( this->fields[AXIS_X_X + axis * 3][i], this->fields[AXIS_X_X + axis * 3 + 1][i], this->fields[AXIS_X_X + axis * 3 + 2][i] );
+            GLfloat low = this->fields[BOX_MIN_X + axis][i], high = this->fields[BOX_MAX_X + axis][i];
+            GLfloat e = glm::dot( a, delta ), f = glm::dot( direction, a );
+            if( fabs( f ) > 0.001f )
+            {
+                GLfloat t1 = ( e + low ) / f, t2 = ( e + high ) / f;
+                tMin = glm::max( tMin, glm::min( t1, t2 ) );
+                tMax = glm::min( tMax, glm::max( t1, t2 ) );
+                if( tMax < tMin )
+                {
+                    return false;
+                }
+            }
+            else if( -e + low > 0.0f || -e + high < 0.0f )
+            {
+                return false;
+            }
+        }
+        distance = tMin;
+        return true;
+    }
+#endif
+};
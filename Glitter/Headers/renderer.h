@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+#include "geometryarena.h"
+#include "glresource.h"
+#include "glstate.h"
+#include "mesh.h"
+#include "model.h"
+#include "occlusionbuffer.h"
+#include "shader.h"
+
+using namespace std;
+
+// Passes are drawn in this order. The sky goes after the opaque scene so it is only shaded where nothing covered it.
+enum RenderPass
+{
+    PASS_OPAQUE = 0,
+    PASS_SKY = 1
+};
+
+// A model moves to a coarser level once that level's error projects to this fraction under the pixel
+// tolerance, and back as soon as its current level's goes over, so it doesn't flicker on the boundary.
+const GLfloat LOD_HYSTERESIS = 0.25f;
+
+// Draws something that isn't a Mesh (the skybox). The renderer has already made the packet's shader current.
+typedef void ( *RenderCallback )( void *context );
+
+/*  One draw call. Sorting by key orders a frame by, from the most significant bits down:
+        pass     2 bits
+        program  8 bits
+        material 16 bits  (first texture of the resolved material)
+        VAO      14 bits
+        depth    24 bits  (view space distance of the instance origin, front to back)
+    Ties go by transform, keeping an instance's meshes together so runs of them can share one multi-draw.
+    GL names are truncated to fit their field; a collision only costs sort quality, never correctness. */
+struct DrawPacket
+{
+    uint64_t key;
+    Shader *shader;
+    const Mesh *mesh;
+    GLuint transform;           // Index into the frame's transforms, for mesh packets
+    GLuint instanceCount;       // Transforms from transform on drawn in one instanced call, 0 for a plain draw
+    GLuint lod;                 // Detail level of the mesh to draw
+    RenderCallback callback;    // For packets without a mesh
+    void *context;
+
+    bool operator<( const DrawPacket &other ) const
+    {
+        return this->key != other.key ? this->key < other.key : this->transform < other.transform;
+    }
+};
+
+// A model submitted this frame, culled and turned into packets by Flush. instanceCount 0 is a single
+// draw with the model uniform, otherwise transforms [transform, transform + instanceCount) are one batch.
+struct RenderInstance
+{
+    const Model *model;
+    Shader *shader;
+    GLuint transform;
+    GLuint instanceCount;
+};
+
+// What the last Flush submitted to GL. instances counts the ones that survived culling, batches counts
+// GeometryArena draws, each covering one or more meshes. triangles is what was drawn, fullDetailTriangles
+// what the same draws would have cost without LOD, and lodInstances how many instances used each level.
+struct RenderStats
+{
+    GLuint instances;
+    GLuint meshes;
+    GLuint batches;
+    GLuint programChanges;
+    GLuint triangles;
+    GLuint fullDetailTriangles;
+    GLuint lodInstances[MAX_LOD_LEVELS];
+};
+
+// Collects the models for a frame, frustum culls them by bounding sphere, picks each one's detail level from its
+// projected size, optionally drops the ones hidden behind occluder models, sorts the surviving meshes for the
+// fewest state changes and front to back for early-Z, then draws them. Every list keeps its capacity between frames,
+// so once they have grown to the scene size a frame costs no heap allocations. Owns a GL buffer, so it
+// has to be created once the context is current.
+class Renderer
+{
+public:
+    /*  Functions  */
+    explicit Renderer( size_t capacity = 64, GLfloat depthRange = 1000.0f )
+        : depthRange( depthRange ), lodEnabled( false ), lodTolerance( 1.0f ), lodViewportHeight( 0.0f ), lodScale( 0.0f ),
+          occlusionEnabled( false )
+    {
+        this->transforms.reserve( capacity );
+        this->transformModels.reserve( capacity );
+        this->previousModels.reserve( capacity );
+        this->lodLevels.reserve( capacity );
+        this->previousLevels.reserve( capacity );
+        this->batchTransforms.reserve( capacity );
+        this->packets.reserve( capacity * 4 );
+        this->instances.reserve( capacity );
+        this->visible.reserve( capacity + 3 );
+        this->instanceBuffer = GLBuffer::Create( );
+        this->stats.instances = 0;
+        this->stats.meshes = 0;
+        this->stats.batches = 0;
+        this->stats.programChanges = 0;
+        this->stats.triangles = 0;
+        this->stats.fullDetailTriangles = 0;
+        fill( this->stats.lodInstances, this->stats.lodInstances + MAX_LOD_LEVELS, 0u );
+    }
+
+    // Turns LOD selection on or off. A model draws the coarsest level whose error stays within pixelTolerance
+    // pixels on a viewport viewportHeight pixels high.
+    void SetLod( bool enabled, GLfloat pixelTolerance, GLfloat viewportHeight )
+    {
+        this->lodEnabled = enabled;
+        this->lodTolerance = pixelTolerance;
+        this->lodViewportHeight = viewportHeight;
+    }
+
+    // Turns occlusion culling on or off. Every visible model marked with Model::SetOccluder is rasterized into a
+    // software depth buffer, the other instances are tested against it by bounding box before they are queued.
+    void SetOcclusion( bool enabled )
+    {
+        this->occlusionEnabled = enabled;
+    }
+
+    // Starts a frame, dropping the previous frame's submissions. view is used for sort depths and, with projection,
+    // for culling; the shaders get the camera from the CameraUniforms block. depthRange should match the far plane.
+    void Begin( const glm::mat4 &view, const glm::mat4 &projection )
+    {
+        this->view = view;
+        this->frustum = Frustum::FromMatrix( projection * view );
+        this->occlusion.Begin( projection * view );
+        this->lodScale = projection[1][1] * this->lodViewportHeight * 0.5f;
+
+        // Levels are matched to last frame's by submission order, the hysteresis needs a stable one
+        this->previousLevels.swap( this->lodLevels );
+        this->previousModels.swap( this->transformModels );
+        this->lodLevels.clear( );
+        this->transformModels.clear( );
+        this->transforms.clear( );
+        this->instances.clear( );
+        this->packets.clear( );
+        this->culler.Clear( );
+    }
+
+    // Queues model drawn with shader at transform, unless its bounding sphere ends up outside the frustum.
+    void Submit( const Model &model, const glm::mat4 &transform, Shader &shader )
+    {
+        RenderInstance instance;
+        instance.model = &model;
+        instance.shader = &shader;
+        instance.transform = this->addTransform( model, transform );
+        instance.instanceCount = 0;
+        this->instances.push_back( instance );
+    }
+
+    // Queues model once for all count transforms, drawn with an instanced shader (one that reads its model matrix
+    // at ATTRIB_INSTANCE_MODEL). Instances are culled one by one, the batch sorts by its nearest visible origin.
+    void Submit( const Model &model, const glm::mat4 *transforms, GLuint count, Shader &shader )
+    {
+        if( count == 0 )
+        {
+            return;
+        }
+
+        RenderInstance instance;
+        instance.model = &model;
+        instance.shader = &shader;
+        instance.transform = ( GLuint )this->transforms.size( );
+        instance.instanceCount = count;
+        for ( GLuint i = 0; i < count; i++ )
+        {
+            this->addTransform( model, transforms[i] );
+        }
+        this->instances.push_back( instance );
+    }
+
+    // Queues a draw the renderer can't issue itself, e.g. the skybox in PASS_SKY.
+    void Submit( RenderPass pass, Shader &shader, RenderCallback callback, void *context )
+    {
+        DrawPacket packet;
+        packet.key = MakeKey( pass, shader.Program, 0, 0, 0 );
+        packet.shader = &shader;
+        packet.mesh = NULL;
+        packet.transform = 0;
+        packet.instanceCount = 0;
+        packet.lod = 0;
+        packet.callback = callback;
+        packet.context = context;
+        this->packets.push_back( packet );
+    }
+
+    // Sorts everything submitted since Begin and draws it. Runs of meshes that share an instance and a material
+    // go out as one GeometryArena draw, the model matrix is the only per-run upload.
+    void Flush( )
+    {
+        this->culler.Cull( this->frustum, this->visible );
+        if( this->occlusionEnabled )
+        {
+            this->cullOccluded( );
+        }
+        this->stats.instances = 0;
+        fill( this->stats.lodInstances, this->stats.lodInstances + MAX_LOD_LEVELS, 0u );
+        bool instancedPackets = false;
+        for ( size_t i = 0; i < this->instances.size( ); i++ )
+        {
+            const RenderInstance &instance = this->instances[i];
+            if( instance.instanceCount == 0 )
+            {
+                if( this->visible[instance.transform] )
+                {
+                    GLuint lod = this->lodLevels[instance.transform];
+                    this->queueMeshes( instance, instance.transform, 0, this->depthOf( instance.transform ), lod );
+                    this->stats.instances++;
+                    this->stats.lodInstances[lod]++;
+                }
+                continue;
+            }
+
+            // Compact the visible transforms of the batch to its front, grouped by level: one instanced draw per level
+            GLuint counts[MAX_LOD_LEVELS] = { 0 };
+            GLuint kept = 0;
+            for ( GLuint j = instance.transform; j < instance.transform + instance.instanceCount; j++ )
+            {
+                if( this->visible[j] )
+                {
+                    counts[this->lodLevels[j]]++;
+                    kept++;
+                }
+            }
+            if( kept == 0 )
+            {
+                continue;
+            }
+
+            GLuint starts[MAX_LOD_LEVELS], filled[MAX_LOD_LEVELS] = { 0 };
+            GLfloat nearest[MAX_LOD_LEVELS];
+            for ( GLuint lod = 0, start = 0; lod < MAX_LOD_LEVELS; lod++ )
+            {
+                starts[lod] = start;
+                start += counts[lod];
+                nearest[lod] = this->depthRange;
+            }
+            this->batchTransforms.resize( kept );
+            for ( GLuint j = instance.transform; j < instance.transform + instance.instanceCount; j++ )
+            {
+                if( this->visible[j] )
+                {
+                    GLuint lod = this->lodLevels[j];
+                    this->batchTransforms[starts[lod] + filled[lod]++] = this->transforms[j];
+                    nearest[lod] = glm::min( nearest[lod], this->depthOf( j ) );
+                }
+            }
+            copy( this->batchTransforms.begin( ), this->batchTransforms.end( ), this->transforms.begin( ) + instance.transform );
+
+            for ( GLuint lod = 0; lod < MAX_LOD_LEVELS; lod++ )
+            {
+                if( counts[lod] > 0 )
+                {
+                    this->queueMeshes( instance, instance.transform + starts[lod], counts[lod], nearest[lod], lod );
+                    this->stats.lodInstances[lod] += counts[lod];
+                }
+            }
+            this->stats.instances += kept;
+            instancedPackets = true;
+        }
+
+        sort( this->packets.begin( ), this->packets.end( ) );
+
+        // Every instanced batch reads its matrices from one upload of the frame's transforms
+        if( instancedPackets )
+        {
+            GLState::Instance( ).BindBuffer( GL_ARRAY_BUFFER, this->instanceBuffer );
+            glBufferData( GL_ARRAY_BUFFER, this->transforms.size( ) * sizeof( glm::mat4 ), &this->transforms[0], GL_STREAM_DRAW );
+        }
+
+        this->stats.meshes = 0;
+        this->stats.batches = 0;
+        this->stats.programChanges = 0;
+        this->stats.triangles = 0;
+        this->stats.fullDetailTriangles = 0;
+
+        DrawElementsIndirectCommand commands[MAX_MULTI_DRAW];
+        Shader *current = NULL;
+        UniformId modelUniform = INVALID_UNIFORM;
+        for ( size_t i = 0; i < this->packets.size( ); )
+        {
+            const DrawPacket &packet = this->packets[i];
+            if( packet.shader != current )
+            {
+                current = packet.shader;
+                current->Use( );
+                modelUniform = current->Standard( UNIFORM_MODEL );
+                this->stats.programChanges++;
+            }
+
+            if( !packet.mesh )
+            {
+                packet.callback( packet.context );
+                i++;
+                continue;
+            }
+
+            // The run of packets drawing the same instance (or instanced batch) with one material becomes one call
+            GLuint count = 0;
+            GLuint copies = packet.instanceCount > 0 ? packet.instanceCount : 1;
+            GLuint baseInstance = packet.instanceCount > 0 ? packet.transform : 0;
+            while( i < this->packets.size( ) && count < MAX_MULTI_DRAW && batches( packet, this->packets[i], *current ) )
+            {
+                const DrawPacket &next = this->packets[i++];
+                commands[count] = next.mesh->Command( copies, baseInstance, next.lod );
+                this->stats.triangles += commands[count++].count / 3 * copies;
+                this->stats.fullDetailTriangles += next.mesh->TriangleCount( ) * copies;
+            }
+
+            if( packet.instanceCount == 0 )
+            {
+                current->Set( modelUniform, this->transforms[packet.transform] );
+            }
+            packet.mesh->Bind( *current );
+            packet.mesh->Arena( ).Draw( commands, count, packet.instanceCount > 0 ? this->instanceBuffer.Id( ) : 0 );
+            this->stats.meshes += count;
+            this->stats.batches++;
+        }
+    }
+
+    const RenderStats &Stats( ) const
+    {
+        return this->stats;
+    }
+
+    // Bounding spheres tested and culled by the last Flush, one per submitted transform.
+    const CullStats &Culling( ) const
+    {
+        return this->culler.Stats( );
+    }
+
+    // Occluders drawn and boxes tested and hidden by the last Flush, all zero with occlusion culling off.
+    const OcclusionStats &Occlusion( ) const
+    {
+        return this->occlusion.Stats( );
+    }
+
+    // Packs the sort fields into a key, see DrawPacket.
+    static uint64_t MakeKey( RenderPass pass, GLuint program, GLuint material, GLuint vertexArray, GLuint depth )
+    {
+        return ( ( uint64_t )( pass & 0x3 ) << 62 ) |
+               ( ( uint64_t )( program & 0xFF ) << 54 ) |
+               ( ( uint64_t )( material & 0xFFFF ) << 38 ) |
+               ( ( uint64_t )( vertexArray & 0x3FFF ) << 24 ) |
+               ( uint64_t )( depth & 0xFFFFFF );
+    }
+
+private:
+    /*  Render Data  */
+    vector<glm::mat4> transforms;
+    // Per transform, the model it places and the level picked for it; last frame's for the hysteresis
+    vector<const Model *> transformModels;
+    vector<GLubyte> lodLevels;
+    vector<const Model *> previousModels;
+    vector<GLubyte> previousLevels;
+    // Where an instanced batch is regrouped by level
+    vector<glm::mat4> batchTransforms;
+    vector<RenderInstance> instances;
+    vector<DrawPacket> packets;
+    FrustumCuller culler;
+    vector<GLubyte> visible;
+    glm::mat4 view;
+    Frustum frustum;
+    GLfloat depthRange;
+    GLBuffer instanceBuffer;
+    RenderStats stats;
+    bool lodEnabled;
+    GLfloat lodTolerance;
+    GLfloat lodViewportHeight;
+    // Pixels per world unit at a view depth of one
+    GLfloat lodScale;
+    OcclusionBuffer occlusion;
+    bool occlusionEnabled;
+
+    /*  Functions   */
+    // Stores transform, queues the model's bounding sphere under it for culling and picks its level, returns its index
+    GLuint addTransform( const Model &model, const glm::mat4 &transform )
+    {
+        glm::vec3 center;
+        GLfloat radius;
+        FrustumCuller::TransformSphere( transform, model.BoundsCenter( ), model.BoundsRadius( ), center, radius );
+        this->culler.Add( center, radius );
+        GLuint index = ( GLuint )this->transforms.size( );
+        this->lodLevels.push_back( this->selectLod( model, center, radius, index ) );
+        this->transformModels.push_back( &model );
+        this->transforms.push_back( transform );
+        return index;
+    }
+
+    // The coarsest level whose error stays within the tolerance on screen, moving at most as far as the
+    // hysteresis allows from the level this transform had last frame
+    GLubyte selectLod( const Model &model, glm::vec3 center, GLfloat radius, GLuint index ) const
+    {
+        GLuint count = model.LodCount( );
+        GLfloat depth = -( this->view * glm::vec4( center, 1.0f ) ).z;
+        if( !this->lodEnabled || count == 1 || model.BoundsRadius( ) <= 0.0f || depth <= radius )
+        {
+            return 0;
+        }
+
+        // Pixels one object unit covers at the instance's distance
+        GLfloat pixels = this->lodScale * ( radius / model.BoundsRadius( ) ) / depth;
+        GLuint lod = index < this->previousModels.size( ) && this->previousModels[index] == &model ? this->previousLevels[index] : 0;
+        lod = std::min( lod, count - 1 );
+        while( lod + 1 < count && model.LodError( lod + 1 ) * pixels <= this->lodTolerance * ( 1.0f - LOD_HYSTERESIS ) )
+        {
+            lod++;
+        }
+        while( lod > 0 && model.LodError( lod ) * pixels > this->lodTolerance )
+        {
+            lod--;
+        }
+        return ( GLubyte )lod;
+    }
+
+    // Draws the occluders that survived the frustum, then hides the other transforms whose boxes lie behind them
+    void cullOccluded( )
+    {
+        for ( GLuint i = 0; i < this->transforms.size( ); i++ )
+        {
+            const Model &model = *this->transformModels[i];
+            if( this->visible[i] && model.IsOccluder( ) )
+            {
+                this->occlusion.AddOccluder( model, model.OccluderLod( ), this->transforms[i] );
+            }
+        }
+        if( this->occlusion.Stats( ).occluders == 0 )
+        {
+            return;
+        }
+
+        this->occlusion.Render( );
+        for ( GLuint i = 0; i < this->transforms.size( ); i++ )
+        {
+            const Model &model = *this->transformModels[i];
+            if( this->visible[i] && !model.IsOccluder( ) &&
+                !this->occlusion.IsVisible( model.BoundsMin( ), model.BoundsMax( ), this->transforms[i] ) )
+            {
+                this->visible[i] = 0;
+            }
+        }
+    }
+
+    GLfloat depthOf( GLuint transform ) const
+    {
+        return -( this->view * this->transforms[transform][3] ).z;
+    }
+
+    // One packet per mesh of the instance at level lod, from transform on; instanceCount 0 draws a single copy with the model uniform
+    void queueMeshes( const RenderInstance &instance, GLuint transform, GLuint instanceCount, GLfloat depth, GLuint lod )
+    {
+        GLuint depthKey = this->quantizeDepth( depth );
+        Shader &shader = *instance.shader;
+        const vector<Mesh> &meshes = instance.model->Meshes( );
+        for ( GLuint i = 0; i < meshes.size( ); i++ )
+        {
+            const Mesh &mesh = meshes[i];
+
+            DrawPacket packet;
+            packet.key = MakeKey( PASS_OPAQUE, shader.Program, mesh.MaterialKey( shader ), mesh.VertexArray( ), depthKey );
+            packet.shader = &shader;
+            packet.mesh = &mesh;
+            packet.transform = transform;
+            packet.instanceCount = instanceCount;
+            packet.lod = lod;
+            packet.callback = NULL;
+            packet.context = NULL;
+            this->packets.push_back( packet );
+        }
+    }
+
+    static bool batches( const DrawPacket &first, const DrawPacket &next, const Shader &shader )
+    {
+        return next.mesh && next.shader == first.shader && next.transform == first.transform &&
+               next.instanceCount == first.instanceCount && next.mesh->CanBatchWith( *first.mesh, shader );
+    }
+
+    // Maps view space distance onto the 24 bit depth field, nearest first
+    GLuint quantizeDepth( GLfloat depth ) const
+    {
+        GLfloat t = glm::clamp( depth / this->depthRange, 0.0f, 1.0f );
+        return ( GLuint )( t * 0xFFFFFF );
+    }
+};
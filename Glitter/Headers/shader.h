@@ -5,12 +5,54 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "camerauniforms.h"
+#include "glresource.h"
+#include "glstate.h"
+#include "vertexformat.h"
+
+// Material slot a texture is bound to, selects the sampler naming convention used by the shaders.
+enum TextureType : GLubyte
+{
+    TEXTURE_DIFFUSE,
+    TEXTURE_SPECULAR,
+    TEXTURE_TYPE_COUNT
+};
+
+inline const char *TextureTypeName( TextureType type )
+{
+    return type == TEXTURE_SPECULAR ? "texture_specular" : "texture_diffuse";
+}
+
+// Highest N looked up for the texture_diffuseN / texture_specularN samplers.
+const GLuint MAX_MATERIAL_SAMPLERS = 4;
+
+// Uniforms the engine sets on every program that declares them, resolved once at link time.
+enum StandardUniform
+{
+    UNIFORM_MODEL,
+    UNIFORM_POSITION_SCALE,
+    UNIFORM_POSITION_OFFSET,
+    UNIFORM_TEXCOORD_TRANSFORM,
+    UNIFORM_MATERIAL_SHININESS,
+    STANDARD_UNIFORM_COUNT
+};
+
+// Index into a Shader's uniform table, INVALID_UNIFORM when the program has no such uniform.
+typedef GLint UniformId;
+const UniformId INVALID_UNIFORM = -1;
+
 class Shader
 {
 public:
-    GLuint Program;
+    GLProgram Program;
     // Constructor generates the shader on the fly
     Shader( const GLchar *vertexPath, const GLchar *fragmentPath )
     {
@@ -71,7 +113,7 @@ public:
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
         }
         // Shader Program
-        this->Program = glCreateProgram( );
+        this->Program = GLProgram::Create( );
         glAttachShader( this->Program, vertex );
         glAttachShader( this->Program, fragment );
         glLinkProgram( this->Program );
@@ -82,15 +124,249 @@ public:
             glGetProgramInfoLog( this->Program, 512, NULL, infoLog );
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
+        // Build the uniform and block tables so nothing is looked up by name while drawing
+        this->reflect( );
+        // Point the shared camera block at its binding point, GLSL 330 can't do this with a layout qualifier
+        GLint cameraBlock = this->Block( "Camera" );
+        if ( cameraBlock >= 0 )
+        {
+            glUniformBlockBinding( this->Program, this->blocks[cameraBlock].index, CAMERA_BLOCK_BINDING );
+        }
         // Delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader( vertex );
         glDeleteShader( fragment );
         
     }
+    
+    // The program is deleted with the Shader, so it can be moved but not copied
+    Shader( Shader && ) = default;
+    Shader &operator=( Shader && ) = default;
+    Shader( const Shader & ) = delete;
+    Shader &operator=( const Shader & ) = delete;
+    
     // Uses the current shader
     void Use( )
     {
-        glUseProgram( this->Program );
+        GLState::Instance( ).UseProgram( this->Program );
+    }
+    
+    // Resolves a uniform name, arrays may be named with or without [0]. Meant for setup code, keep it out of draw loops.
+    UniformId Uniform( const char *name ) const
+    {
+        for ( GLuint i = 0; i < this->uniforms.size( ); i++ )
+        {
+            if ( this->uniforms[i].name == name )
+            {
+                return ( UniformId )i;
+            }
+        }
+        return INVALID_UNIFORM;
+    }
+    
+    UniformId Standard( StandardUniform uniform ) const
+    {
+        return this->standardIds[uniform];
+    }
+    
+    // The texture_diffuseN / texture_specularN sampler for N = number, 1 based like the names
+    UniformId Sampler( TextureType type, GLuint number ) const
+    {
+        return number >= 1 && number <= MAX_MATERIAL_SAMPLERS ? this->samplerIds[type][number - 1] : INVALID_UNIFORM;
+    }
+    
+    // Fixed texture unit of a material sampler, the same in every program so materials can be bound without asking the shader
+    static GLuint MaterialUnit( TextureType type, GLuint number )
+    {
+        return type * MAX_MATERIAL_SAMPLERS + number - 1;
+    }
+    
+    // Index into the block table, -1 if the program has no such block.
+    GLint Block( const char *name ) const
+    {
+        for ( GLuint i = 0; i < this->blocks.size( ); i++ )
+        {
+            if ( this->blocks[i].name == name )
+            {
+                return ( GLint )i;
+            }
+        }
+        return -1;
+    }
+    
+    /*  Typed setters. The program has to be in use. Values equal to the last one uploaded through the
+        same id are skipped, invalid ids are ignored like location -1 is by GL. */
+    void Set( UniformId id, GLint value )
+    {
+        if ( this->changed( id, &value, sizeof( value ) ) )
+        {
+            glUniform1i( this->uniforms[id].location, value );
+        }
+    }
+    
+    void Set( UniformId id, GLfloat value )
+    {
+        if ( this->changed( id, &value, sizeof( value ) ) )
+        {
+            glUniform1f( this->uniforms[id].location, value );
+        }
+    }
+    
+    void Set( UniformId id, const glm::vec3 &value )
+    {
+        if ( this->changed( id, glm::value_ptr( value ), sizeof( value ) ) )
+        {
+            glUniform3fv( this->uniforms[id].location, 1, glm::value_ptr( value ) );
+        }
+    }
+    
+    void Set( UniformId id, const glm::vec4 &value )
+    {
+        if ( this->changed( id, glm::value_ptr( value ), sizeof( value ) ) )
+        {
+            glUniform4fv( this->uniforms[id].location, 1, glm::value_ptr( value ) );
+        }
+    }
+    
+    void Set( UniformId id, const glm::mat4 &value )
+    {
+        if ( this->changed( id, glm::value_ptr( value ), sizeof( value ) ) )
+        {
+            glUniformMatrix4fv( this->uniforms[id].location, 1, GL_FALSE, glm::value_ptr( value ) );
+        }
+    }
+    
+    // Returns the mesh vertex streams (see VertexAttribLocation) this program actually reads.
+    VertexStreamMask ActiveStreams( ) const
+    {
+        GLint count = 0;
+        GLchar name[256];
+        VertexStreamMask streams = 0;
+        
+        glGetProgramiv( this->Program, GL_ACTIVE_ATTRIBUTES, &count );
+        for ( GLint i = 0; i < count; i++ )
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveAttrib( this->Program, ( GLuint )i, sizeof( name ), NULL, &size, &type, name );
+            GLint location = glGetAttribLocation( this->Program, name );
+            if( location >= ATTRIB_POSITION && location <= ATTRIB_TEXCOORD )
+            {
+                streams |= ( VertexStreamMask )( 1 << location );
+            }
+        }
+        
+        return streams;
+    }
+    
+private:
+    // One active default-block uniform with the last value uploaded through the setters
+    struct UniformInfo
+    {
+        std::string name;
+        GLint location;
+        GLenum type;
+        GLint size;
+        GLuint cachedBytes;
+        unsigned char cached[sizeof( glm::mat4 )];
+    };
+    
+    struct BlockInfo
+    {
+        std::string name;
+        GLuint index;
+        GLint dataSize;
+    };
+    
+    /*  Reflection Data  */
+    std::vector<UniformInfo> uniforms;
+    std::vector<BlockInfo> blocks;
+    UniformId standardIds[STANDARD_UNIFORM_COUNT];
+    UniformId samplerIds[TEXTURE_TYPE_COUNT][MAX_MATERIAL_SAMPLERS];
+    
+    // Reads the active uniforms and uniform blocks of the linked program
+    void reflect( )
+    {
+        GLint count = 0;
+        GLchar name[256];
+        
+        glGetProgramiv( this->Program, GL_ACTIVE_UNIFORMS, &count );
+        for ( GLint i = 0; i < count; i++ )
+        {
+            UniformInfo uniform;
+            glGetActiveUniform( this->Program, ( GLuint )i, sizeof( name ), NULL, &uniform.size, &uniform.type, name );
+            uniform.location = glGetUniformLocation( this->Program, name );
+            // Members of uniform blocks have no location, they are reached through the block
+            if ( uniform.location < 0 )
+            {
+                continue;
+            }
+            
+            // Arrays are reported as name[0], store them under the plain name
+            size_t length = strlen( name );
+            if ( length > 3 && strcmp( name + length - 3, "[0]" ) == 0 )
+            {
+                name[length - 3] = '\0';
+            }
+            uniform.name = name;
+            uniform.cachedBytes = 0;
+            this->uniforms.push_back( uniform );
+        }
+        
+        glGetProgramiv( this->Program, GL_ACTIVE_UNIFORM_BLOCKS, &count );
+        for ( GLint i = 0; i < count; i++ )
+        {
+            BlockInfo block;
+            glGetActiveUniformBlockName( this->Program, ( GLuint )i, sizeof( name ), NULL, name );
+            glGetActiveUniformBlockiv( this->Program, ( GLuint )i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize );
+            block.name = name;
+            block.index = ( GLuint )i;
+            this->blocks.push_back( block );
+        }
+        
+        static const char *standardNames[STANDARD_UNIFORM_COUNT] =
+        {
+            "model", "positionScale", "positionOffset", "texCoordTransform", "material.shininess"
+        };
+        for ( GLuint i = 0; i < STANDARD_UNIFORM_COUNT; i++ )
+        {
+            this->standardIds[i] = this->Uniform( standardNames[i] );
+        }
+        
+        // Material samplers never change unit, so set them once here instead of on every draw
+        GLState &state = GLState::Instance( );
+        GLuint previous = state.Program( );
+        state.UseProgram( this->Program );
+        for ( GLuint type = 0; type < TEXTURE_TYPE_COUNT; type++ )
+        {
+            for ( GLuint n = 0; n < MAX_MATERIAL_SAMPLERS; n++ )
+            {
+                snprintf( name, sizeof( name ), "%s%u", TextureTypeName( ( TextureType )type ), n + 1 );
+                this->samplerIds[type][n] = this->Uniform( name );
+                this->Set( this->samplerIds[type][n], ( GLint )MaterialUnit( ( TextureType )type, n + 1 ) );
+            }
+        }
+        if ( previous != GLState::UNKNOWN )
+        {
+            state.UseProgram( previous );
+        }
+    }
+    
+    // Records value for id and reports whether it differs from what was uploaded last
+    bool changed( UniformId id, const void *value, GLuint bytes )
+    {
+        if ( id < 0 )
+        {
+            return false;
+        }
+        
+        UniformInfo &uniform = this->uniforms[id];
+        if ( uniform.cachedBytes == bytes && memcmp( uniform.cached, value, bytes ) == 0 )
+        {
+            return false;
+        }
+        memcpy( uniform.cached, value, bytes );
+        uniform.cachedBytes = bytes;
+        return true;
     }
 };
 
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <glad/glad.h>
+
+using namespace std;
+
+/*  Runs game logic at a fixed rate on its own thread, independent of how fast frames are drawn. Each tick
+    gets the latest Input the main thread handed over and advances a private copy of State by exactly one
+    step, which is then published into a double buffer: the tick before and the newest tick. The renderer
+    samples both with the fraction of a step that has passed since the newest was published and blends
+    them, so motion stays smooth at any frame rate while drawing runs at most one tick behind.
+
+    Anything the step function touches belongs to the simulation thread while it runs; the main thread
+    talks to it only through SetInput and Sample. */
+template <class State, class Input>
+class Simulation
+{
+public:
+    typedef function<void( State &state, const Input &input, GLfloat step )> StepFunction;
+
+    /*  Functions  */
+    // Constructor, rate is in ticks per second. Nothing runs until Start.
+    Simulation( const State &initial, StepFunction step, GLfloat rate = 60.0f )
+        : working( initial ), stepFunction( step ), step( 1.0f / rate ), latest( 0 ), ticks( 0 ), running( false )
+    {
+        this->snapshots[0] = initial;
+        this->snapshots[1] = initial;
+        this->published = chrono::steady_clock::now( );
+    }
+
+    ~Simulation( )
+    {
+        this->Stop( );
+    }
+
+    Simulation( const Simulation & ) = delete;
+    Simulation &operator=( const Simulation & ) = delete;
+
+    void Start( )
+    {
+        if( this->running )
+        {
+            return;
+        }
+        this->running = true;
+        this->worker = thread( &Simulation::run, this );
+    }
+
+    // Finishes the tick in progress and joins the thread, the step function's data is the caller's again.
+    void Stop( )
+    {
+        {
+            lock_guard<mutex> lock( this->stateMutex );
+            if( !this->running )
+            {
+                return;
+            }
+            this->running = false;
+        }
+        this->worker.join( );
+    }
+
+    // The input the next tick sees, replacing the previous one.
+    void SetInput( const Input &input )
+    {
+        lock_guard<mutex> lock( this->stateMutex );
+        this->input = input;
+    }
+
+    // Copies the two newest ticks and returns how far from previous to current the present is, 0 to 1.
+    GLfloat Sample( State &previous, State &current ) const
+    {
+        lock_guard<mutex> lock( this->stateMutex );
+        previous = this->snapshots[1 - this->latest];
+        current = this->snapshots[this->latest];
+        GLfloat elapsed = chrono::duration<GLfloat>( chrono::steady_clock::now( ) - this->published ).count( );
+        return std::min( std::max( elapsed / this->step, 0.0f ), 1.0f );
+    }
+
+    // Ticks run so far.
+    GLuint Ticks( ) const
+    {
+        lock_guard<mutex> lock( this->stateMutex );
+        return this->ticks;
+    }
+
+    GLfloat Step( ) const
+    {
+        return this->step;
+    }
+
+private:
+    // A thread that falls further behind than this skips ahead instead of trying to catch up
+    static const int MAX_CATCH_UP_TICKS = 5;
+
+    /*  Simulation Data  */
+    State working;
+    State snapshots[2];
+    Input input;
+    StepFunction stepFunction;
+    GLfloat step;
+    int latest;
+    GLuint ticks;
+    chrono::steady_clock::time_point published;
+    bool running;
+    mutable mutex stateMutex;
+    thread worker;
+
+    /*  Functions   */
+    void run( )
+    {
+        chrono::steady_clock::duration interval = chrono::duration_cast<chrono::steady_clock::duration>( chrono::duration<double>( this->step ) );
+        chrono::steady_clock::time_point next = chrono::steady_clock::now( );
+        for ( ;; )
+        {
+            Input tickInput;
+            {
+                lock_guard<mutex> lock( this->stateMutex );
+                if( !this->running )
+                {
+                    return;
+                }
+                tickInput = this->input;
+            }
+
+            this->stepFunction( this->working, tickInput, this->step );
+
+            // The older buffer becomes the newest, readers only ever copy under the lock
+            {
+                lock_guard<mutex> lock( this->stateMutex );
+                this->latest = 1 - this->latest;
+                this->snapshots[this->latest] = this->working;
+                this->published = chrono::steady_clock::now( );
+                this->ticks++;
+            }
+
+            next += interval;
+            chrono::steady_clock::time_point now = chrono::steady_clock::now( );
+            if( now - next > interval * int( MAX_CATCH_UP_TICKS ) )
+            {
+                next = now;
+            }
+            this_thread::sleep_until( next );
+        }
+    }
+};
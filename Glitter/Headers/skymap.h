@@ -9,6 +9,8 @@
 #include <iostream>
 #include "shader.h"
 #include "camera.h"
+#include "glresource.h"
+#include "glstate.h"
 
 //#include "Texture.h"
 
@@ -19,17 +21,15 @@ public:
 	Skymap() {
 
 	}
-	void CreateBuffers(GLuint VAO, GLuint VBO) {
-		bufferVAO = VAO;
-		bufferVBO = VBO;
-		glGenVertexArrays(1, &bufferVAO);
-		glGenBuffers(1, &bufferVBO);
-		glBindVertexArray(bufferVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, bufferVBO);
+	// The cube's VAO and VBO are owned here, so the Skymap has to go before the context does
+	void CreateBuffers() {
+		bufferVAO = GLVertexArray::Create();
+		bufferVBO = GLBuffer::Create();
+		GLState::Instance().BindVertexArray(bufferVAO);
+		GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, bufferVBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid *)0);
-		glBindVertexArray(0);
 	}
 	GLuint GetVBO() {
 		return bufferVBO;
@@ -71,7 +71,8 @@ public:
 private:
 	GLuint cubemapTexture;
 	std::vector<const GLchar*> faces;
-	GLuint bufferVAO, bufferVBO;
+	GLVertexArray bufferVAO;
+	GLBuffer bufferVBO;
 	GLfloat skyboxVertices[108] = {
 		// Positions
 		-1.0f, 1.0f, -1.0f,
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include "glitter.hpp"
+
+#include "glstate.h"
+#include "threadpool.h"
+
+using namespace std;
+
+// Pixels decoded by a worker, waiting for upload on the context thread.
+struct DecodedImage
+{
+    unsigned char *pixels;
+    int width;
+    int height;
+    double decodeSeconds;
+};
+
+// Startup numbers for the texture pipeline. Decode time is summed over all workers, so
+// decode + upload - wall is the time the two stages overlapped each other and the rest of loading.
+struct TextureLoadStats
+{
+    GLuint images;
+    size_t bytes;
+    double decodeSeconds;
+    double uploadSeconds;
+    double wallSeconds;
+};
+
+// Decodes image files on the shared worker pool and uploads them on the GL thread.
+// Texture names are handed out immediately so meshes can reference them; their storage is
+// filled in by Flush, which must be called on the thread that owns the context.
+class TextureLoader
+{
+public:
+    /*  Functions  */
+    static TextureLoader &Instance( )
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    // Returns a new 2D texture and queues filename for decoding. Mipmaps are built on upload.
+    GLuint Load2D( const string &filename )
+    {
+        GLuint textureID;
+        glGenTextures( 1, &textureID );
+
+        GLState::Instance( ).BindTexture( GL_TEXTURE_2D, textureID );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+
+        this->queue( textureID, GL_TEXTURE_2D, GL_TEXTURE_2D, filename );
+
+        return textureID;
+    }
+
+    // Returns a new cubemap and queues its six faces (+X, -X, +Y, -Y, +Z, -Z) for decoding.
+    GLuint LoadCubemap( const vector<string> &faces )
+    {
+        GLuint textureID;
+        glGenTextures( 1, &textureID );
+
+        GLState::Instance( ).BindTexture( GL_TEXTURE_CUBE_MAP, textureID );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+
+        for ( GLuint i = 0; i < faces.size( ); i++ )
+        {
+            this->queue( textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, faces[i] );
+        }
+
+        return textureID;
+    }
+
+    // Uploads every queued image, taking them in the order the workers finish rather than the order they were queued.
+    void Flush( )
+    {
+        while( !this->pending.empty( ) )
+        {
+            size_t ready = 0;
+
+            for ( size_t i = 0; i < this->pending.size( ); i++ )
+            {
+                if( this->pending[i].image.wait_for( chrono::seconds( 0 ) ) == future_status::ready )
+                {
+                    ready = i;
+                    break;
+                }
+            }
+
+            // Nothing finished yet: block on the oldest request
+            this->upload( this->pending[ready] );
+            this->pending.erase( this->pending.begin( ) + ready );
+        }
+
+        if( this->stats.images > 0 )
+        {
+            this->stats.wallSeconds = seconds( this->firstRequest, chrono::steady_clock::now( ) );
+        }
+    }
+
+    const TextureLoadStats &Stats( ) const
+    {
+        return this->stats;
+    }
+
+    // Prints how much of the decode and upload work was hidden behind other loading.
+    void PrintReport( ) const
+    {
+        double overlap = this->stats.decodeSeconds + this->stats.uploadSeconds - this->stats.wallSeconds;
+
+        printf( "TEXTURES:: %u images, %.1f MB decoded on %u workers\n", this->stats.images,
+                this->stats.bytes / ( 1024.0 * 1024.0 ), ThreadPool::Shared( ).Size( ) );
+        printf( "TEXTURES:: decode %.3fs (summed), upload %.3fs, wall %.3fs, overlapped %.3fs\n",
+                this->stats.decodeSeconds, this->stats.uploadSeconds, this->stats.wallSeconds, overlap > 0.0 ? overlap : 0.0 );
+    }
+
+private:
+    // An image whose decode has been queued but not yet uploaded.
+    struct PendingUpload
+    {
+        GLuint id;
+        GLenum bindTarget;
+        GLenum imageTarget;
+        string filename;
+        future<DecodedImage> image;
+    };
+
+    /*  Loader Data  */
+    vector<PendingUpload> pending;
+    TextureLoadStats stats;
+    chrono::steady_clock::time_point firstRequest;
+
+    TextureLoader( )
+    {
+        this->stats.images = 0;
+        this->stats.bytes = 0;
+        this->stats.decodeSeconds = 0.0;
+        this->stats.uploadSeconds = 0.0;
+        this->stats.wallSeconds = 0.0;
+    }
+
+    /*  Functions   */
+    void queue( GLuint id, GLenum bindTarget, GLenum imageTarget, const string &filename )
+    {
+        if( this->stats.images == 0 && this->pending.empty( ) )
+        {
+            this->firstRequest = chrono::steady_clock::now( );
+        }
+
+        PendingUpload upload;
+        upload.id = id;
+        upload.bindTarget = bindTarget;
+        upload.imageTarget = imageTarget;
+        upload.filename = filename;
+        upload.image = ThreadPool::Shared( ).Submit( [filename]( )
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now( );
+            DecodedImage image;
+            image.width = image.height = 0;
+            image.pixels = stbi_load( filename.c_str( ), &image.width, &image.height, 0, STBI_rgb );
+            image.decodeSeconds = seconds( start, chrono::steady_clock::now( ) );
+            return image;
+        } );
+
+        this->pending.push_back( move( upload ) );
+    }
+
+    void upload( PendingUpload &upload )
+    {
+        DecodedImage image = upload.image.get( );
+        chrono::steady_clock::time_point start = chrono::steady_clock::now( );
+
+        if( !image.pixels )
+        {
+            cout << "ERROR::TEXTURE:: failed to load " << upload.filename << endl;
+            return;
+        }
+
+        GLState::Instance( ).BindTexture( upload.bindTarget, upload.id );
+        glTexImage2D( upload.imageTarget, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels );
+        if( upload.bindTarget == GL_TEXTURE_2D )
+        {
+            glGenerateMipmap( GL_TEXTURE_2D );
+        }
+        stbi_image_free( image.pixels );
+
+        this->stats.images++;
+        this->stats.bytes += ( size_t )image.width * image.height * 3;
+        this->stats.decodeSeconds += image.decodeSeconds;
+        this->stats.uploadSeconds += seconds( start, chrono::steady_clock::now( ) );
+    }
+
+    static double seconds( chrono::steady_clock::time_point from, chrono::steady_clock::time_point to )
+    {
+        return chrono::duration<double>( to - from ).count( );
+    }
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "glresource.h"
+#include "textureloader.h"
+
+using namespace std;
+
+// Compact reference to a texture owned by the TextureRegistry. 0 never names a texture.
+typedef GLushort TextureHandle;
+const TextureHandle INVALID_TEXTURE = 0;
+
+// Process-wide table of 2D textures keyed by canonical file path. Every file is decoded and uploaded
+// once no matter how many models (or main.cpp) ask for it; users hold reference counted handles.
+class TextureRegistry
+{
+public:
+    /*  Functions  */
+    static TextureRegistry &Instance( )
+    {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // Returns a handle for path, loading the file on first use. Each call adds one reference.
+    TextureHandle Acquire( const string &path )
+    {
+        string key = CanonicalPath( path );
+        unordered_map<string, TextureHandle>::const_iterator found = this->byPath.find( key );
+
+        if( found != this->byPath.end( ) )
+        {
+            this->slots[found->second].refCount++;
+            return found->second;
+        }
+
+        TextureHandle handle;
+        if( !this->freeSlots.empty( ) )
+        {
+            handle = this->freeSlots.back( );
+            this->freeSlots.pop_back( );
+        }
+        else
+        {
+            if( this->slots.size( ) > 0xFFFF )
+            {
+                cout << "ERROR::TEXTUREREGISTRY:: out of handles loading " << key << endl;
+                return INVALID_TEXTURE;
+            }
+            handle = ( TextureHandle )this->slots.size( );
+            this->slots.push_back( Slot( ) );
+        }
+
+        Slot &slot = this->slots[handle];
+        slot.texture.Reset( TextureLoader::Instance( ).Load2D( key ) );
+        slot.refCount = 1;
+        slot.path = key;
+        this->byPath[key] = handle;
+
+        return handle;
+    }
+
+    // Adds a reference to a handle that is already held.
+    void AddRef( TextureHandle handle )
+    {
+        if( handle != INVALID_TEXTURE )
+        {
+            this->slots[handle].refCount++;
+        }
+    }
+
+    // Drops one reference; the GL texture is deleted and the handle recycled when the last one goes.
+    void Release( TextureHandle handle )
+    {
+        if( handle == INVALID_TEXTURE || handle >= this->slots.size( ) || this->slots[handle].refCount == 0 )
+        {
+            return;
+        }
+
+        Slot &slot = this->slots[handle];
+        if( --slot.refCount == 0 )
+        {
+            slot.texture.Reset( );
+            this->byPath.erase( slot.path );
+            slot.path.clear( );
+            this->freeSlots.push_back( handle );
+        }
+    }
+
+    // GL name for a handle, 0 for INVALID_TEXTURE.
+    GLuint Id( TextureHandle handle ) const
+    {
+        return this->slots[handle].texture;
+    }
+
+    const string &Path( TextureHandle handle ) const
+    {
+        return this->slots[handle].path;
+    }
+
+    // Video memory used by a texture, including its mip chain. Queries GL, so keep it out of the frame loop.
+    size_t Bytes( TextureHandle handle ) const
+    {
+        GLuint id = this->slots[handle].texture;
+        if( id == 0 )
+        {
+            return 0;
+        }
+
+        GLint width = 0, height = 0;
+        GLState::Instance( ).BindTexture( GL_TEXTURE_2D, id );
+        glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width );
+        glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height );
+
+        // Textures are stored as RGB8, a full mip chain adds a third
+        return ( size_t )width * height * 3 * 4 / 3;
+    }
+
+    GLuint RefCount( TextureHandle handle ) const
+    {
+        return this->slots[handle].refCount;
+    }
+
+    // Normalises separators and removes "." and ".." segments so the same file always maps to the same key.
+    static string CanonicalPath( const string &path )
+    {
+        vector<string> parts;
+        string part;
+        bool absolute = !path.empty( ) && ( path[0] == '/' || path[0] == '\\' );
+
+        for ( size_t i = 0; i <= path.size( ); i++ )
+        {
+            if( i == path.size( ) || path[i] == '/' || path[i] == '\\' )
+            {
+                if( part == ".." && !parts.empty( ) && parts.back( ) != ".." )
+                {
+                    parts.pop_back( );
+                }
+                else if( !part.empty( ) && part != "." )
+                {
+                    parts.push_back( part );
+                }
+                part.clear( );
+            }
+            else
+            {
+                part += path[i];
+            }
+        }
+
+        string result = absolute ? "/" : "";
+        for ( size_t i = 0; i < parts.size( ); i++ )
+        {
+            if( i > 0 )
+            {
+                result += '/';
+            }
+            result += parts[i];
+        }
+        return result;
+    }
+
+private:
+    struct Slot
+    {
+        Slot( ) : refCount( 0 ) { }
+
+        GLTexture texture;
+        GLuint refCount;
+        string path;
+    };
+
+    /*  Registry Data  */
+    vector<Slot> slots;
+    vector<TextureHandle> freeSlots;
+    unordered_map<string, TextureHandle> byPath;
+
+    TextureRegistry( )
+    {
+        // Slot 0 backs INVALID_TEXTURE so Id( INVALID_TEXTURE ) binds nothing
+        this->slots.push_back( Slot( ) );
+    }
+
+    TextureRegistry( const TextureRegistry & );
+    TextureRegistry &operator=( const TextureRegistry & );
+};
+
+// Move-only owner of one TextureRegistry reference, released when the owner goes away.
+class TextureRef
+{
+public:
+    /*  Functions  */
+    TextureRef( ) : handle( INVALID_TEXTURE ) { }
+
+    // Adopts a reference returned by TextureRegistry::Acquire
+    explicit TextureRef( TextureHandle handle ) : handle( handle ) { }
+
+    TextureRef( TextureRef &&other ) : handle( other.handle )
+    {
+        other.handle = INVALID_TEXTURE;
+    }
+
+    TextureRef &operator=( TextureRef &&other )
+    {
+        std::swap( this->handle, other.handle );
+        return *this;
+    }
+
+    TextureRef( const TextureRef & ) = delete;
+    TextureRef &operator=( const TextureRef & ) = delete;
+
+    ~TextureRef( )
+    {
+        TextureRegistry::Instance( ).Release( this->handle );
+    }
+
+    operator TextureHandle( ) const
+    {
+        return this->handle;
+    }
+
+private:
+    TextureHandle handle;
+};
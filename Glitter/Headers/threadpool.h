@@ -0,0 +1,113 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+// A fixed set of worker threads consuming a shared FIFO of tasks.
+class ThreadPool
+{
+public:
+    /*  Functions  */
+    // Constructor, a thread count of 0 uses one worker per hardware thread minus the one running GL.
+    explicit ThreadPool( unsigned threadCount = 0 ) : stopping( false )
+    {
+        if( threadCount == 0 )
+        {
+            unsigned hardware = thread::hardware_concurrency( );
+            threadCount = hardware > 1 ? hardware - 1 : 1;
+        }
+
+        for ( unsigned i = 0; i < threadCount; i++ )
+        {
+            this->workers.push_back( thread( &ThreadPool::workerLoop, this ) );
+        }
+    }
+
+    ~ThreadPool( )
+    {
+        {
+            lock_guard<mutex> lock( this->queueMutex );
+            this->stopping = true;
+        }
+        this->wake.notify_all( );
+
+        for ( size_t i = 0; i < this->workers.size( ); i++ )
+        {
+            this->workers[i].join( );
+        }
+    }
+
+    // Queues a callable and returns a future for its result.
+    template <class Task>
+    future<typename result_of<Task( )>::type> Submit( Task task )
+    {
+        typedef typename result_of<Task( )>::type Result;
+
+        shared_ptr<packaged_task<Result( )> > packaged = make_shared<packaged_task<Result( )> >( task );
+        future<Result> result = packaged->get_future( );
+
+        {
+            lock_guard<mutex> lock( this->queueMutex );
+            this->tasks.push( [packaged]( ) { ( *packaged )( ); } );
+        }
+        this->wake.notify_one( );
+
+        return result;
+    }
+
+    unsigned Size( ) const
+    {
+        return ( unsigned )this->workers.size( );
+    }
+
+    // The process-wide pool used for asset decoding.
+    static ThreadPool &Shared( )
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    ThreadPool( const ThreadPool & );
+    ThreadPool &operator=( const ThreadPool & );
+
+    /*  Pool Data  */
+    vector<thread> workers;
+    queue<function<void( )> > tasks;
+    mutex queueMutex;
+    condition_variable wake;
+    bool stopping;
+
+    /*  Functions   */
+    void workerLoop( )
+    {
+        for ( ;; )
+        {
+            function<void( )> task;
+
+            {
+                unique_lock<mutex> lock( this->queueMutex );
+                this->wake.wait( lock, [this]( ) { return this->stopping || !this->tasks.empty( ); } );
+
+                if( this->stopping && this->tasks.empty( ) )
+                {
+                    return;
+                }
+
+                task = move( this->tasks.front( ) );
+                this->tasks.pop( );
+            }
+
+            task( );
+        }
+    }
+};
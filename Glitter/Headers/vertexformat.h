@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// Attribute locations shared by every shader that draws a Mesh.
+enum VertexAttribLocation
+{
+    ATTRIB_POSITION = 0,
+    ATTRIB_NORMAL = 1,
+    ATTRIB_TEXCOORD = 2,
+    ATTRIB_INSTANCE_MODEL = 3   // Instanced shaders only, a mat4 taking locations 3 to 6
+};
+
+// Which vertex streams a shader consumes, and therefore which a mesh has to upload.
+typedef GLubyte VertexStreamMask;
+const VertexStreamMask STREAM_POSITION = 1 << ATTRIB_POSITION;
+const VertexStreamMask STREAM_NORMAL = 1 << ATTRIB_NORMAL;
+const VertexStreamMask STREAM_TEXCOORD = 1 << ATTRIB_TEXCOORD;
+const VertexStreamMask STREAM_ALL = STREAM_POSITION | STREAM_NORMAL | STREAM_TEXCOORD;
+
+// One attribute inside an interleaved vertex.
+struct VertexAttribute
+{
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset;
+};
+
+// Describes an interleaved vertex buffer so the attribute pointer setup isn't hardcoded per mesh.
+struct VertexLayout
+{
+    GLsizei stride;
+    GLuint attributeCount;
+    VertexAttribute attributes[3];
+
+    // Points the bound VAO's attributes at the bound GL_ARRAY_BUFFER.
+    void Apply( ) const
+    {
+        for ( GLuint i = 0; i < this->attributeCount; i++ )
+        {
+            const VertexAttribute &attribute = this->attributes[i];
+            glEnableVertexAttribArray( attribute.location );
+            glVertexAttribPointer( attribute.location, attribute.components, attribute.type, attribute.normalized,
+                                   this->stride, ( GLvoid * )( size_t )attribute.offset );
+        }
+    }
+};
+
+// Per-instance model matrices, tightly packed mat4s read at ATTRIB_INSTANCE_MODEL one column per location.
+struct InstanceLayout
+{
+    // Points the bound VAO's instance attributes at the bound GL_ARRAY_BUFFER, starting at firstInstance.
+    // GL 3.3 has no base instance draw, so the attribute offset is moved instead.
+    static void Apply( GLuint firstInstance )
+    {
+        size_t base = ( size_t )firstInstance * sizeof( glm::mat4 );
+        for ( GLuint column = 0; column < 4; column++ )
+        {
+            GLuint location = ATTRIB_INSTANCE_MODEL + column;
+            glEnableVertexAttribArray( location );
+            glVertexAttribPointer( location, 4, GL_FLOAT, GL_FALSE, sizeof( glm::mat4 ),
+                                   ( GLvoid * )( base + column * sizeof( glm::vec4 ) ) );
+            glVertexAttribDivisor( location, 1 );
+        }
+    }
+};
+
+// Scale and offset a shader applies to the integer attributes to get object space values back.
+struct VertexDequantization
+{
+    glm::vec3 positionScale;
+    glm::vec3 positionOffset;
+    glm::vec4 texCoordTransform; // xy scale, zw offset
+};
+
+// The box quantized positions and texcoords are relative to. Meshes packed against the same bounds share
+// their dequantization uniforms, which lets a whole model go out in one multi-draw.
+struct QuantizationBounds
+{
+    glm::vec3 positionMin;
+    glm::vec3 positionMax;
+    glm::vec2 texCoordMin;
+    glm::vec2 texCoordMax;
+
+    // Bounds that contain nothing yet
+    static QuantizationBounds Empty( )
+    {
+        QuantizationBounds bounds;
+        bounds.positionMin = glm::vec3( FLT_MAX );
+        bounds.positionMax = glm::vec3( -FLT_MAX );
+        bounds.texCoordMin = glm::vec2( FLT_MAX );
+        bounds.texCoordMax = glm::vec2( -FLT_MAX );
+        return bounds;
+    }
+
+    // Grows the bounds over count vertices (anything with Position/TexCoords members).
+    template <class SourceVertex>
+    void Include( const SourceVertex *vertices, size_t count )
+    {
+        for ( size_t i = 0; i < count; i++ )
+        {
+            this->positionMin = glm::min( this->positionMin, vertices[i].Position );
+            this->positionMax = glm::max( this->positionMax, vertices[i].Position );
+            this->texCoordMin = glm::min( this->texCoordMin, vertices[i].TexCoords );
+            this->texCoordMax = glm::max( this->texCoordMax, vertices[i].TexCoords );
+        }
+    }
+
+    bool operator==( const QuantizationBounds &other ) const
+    {
+        return this->positionMin == other.positionMin && this->positionMax == other.positionMax &&
+               this->texCoordMin == other.texCoordMin && this->texCoordMax == other.texCoordMax;
+    }
+};
+
+/*  Quantized vertex format
+    position  int16 x3 + pad   8 bytes, relative to the quantization bounds
+    normal    int16 x2         4 bytes, octahedral encoding
+    texcoord  uint16 x2        4 bytes, relative to the quantization UV bounds
+    16 bytes with every stream against 32 for float Vertex. Attributes are uploaded unnormalized and the
+    scale folded into the dequantization uniforms, which keeps the math exact on GL 3.3 (whose snorm
+    conversion has no exact zero). */
+class QuantizedVertexFormat
+{
+public:
+    /*  Functions  */
+    static VertexLayout Layout( VertexStreamMask streams )
+    {
+        VertexLayout layout;
+        layout.stride = 0;
+        layout.attributeCount = 0;
+
+        if( streams & STREAM_POSITION )
+        {
+            addAttribute( layout, ATTRIB_POSITION, 3, GL_SHORT, 8 );
+        }
+        if( streams & STREAM_NORMAL )
+        {
+            addAttribute( layout, ATTRIB_NORMAL, 2, GL_SHORT, 4 );
+        }
+        if( streams & STREAM_TEXCOORD )
+        {
+            addAttribute( layout, ATTRIB_TEXCOORD, 2, GL_UNSIGNED_SHORT, 4 );
+        }
+
+        return layout;
+    }
+
+    // Packs count vertices (anything with Position/Normal/TexCoords members) into out using Layout( streams ).
+    // Every vertex has to lie inside bounds.
+    template <class SourceVertex>
+    static VertexDequantization Pack( const SourceVertex *vertices, size_t count, VertexStreamMask streams,
+                                      const QuantizationBounds &bounds, vector<unsigned char> &out )
+    {
+        VertexLayout layout = Layout( streams );
+        out.assign( count * layout.stride, 0 );
+
+        glm::vec3 center, halfExtent;
+        glm::vec2 uvMin, uvRange;
+        quantizationRange( bounds, center, halfExtent, uvMin, uvRange );
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+            unsigned char *vertex = &out[i * layout.stride];
+
+            if( streams & STREAM_POSITION )
+            {
+                glm::vec3 p = ( vertices[i].Position - center ) / halfExtent;
+                GLshort packed[4] = { snorm16( p.x ), snorm16( p.y ), snorm16( p.z ), 0 };
+                memcpy( vertex, packed, sizeof( packed ) );
+                vertex += sizeof( packed );
+            }
+            if( streams & STREAM_NORMAL )
+            {
+                glm::vec2 e = octahedralEncode( vertices[i].Normal );
+                GLshort packed[2] = { snorm16( e.x ), snorm16( e.y ) };
+                memcpy( vertex, packed, sizeof( packed ) );
+                vertex += sizeof( packed );
+            }
+            if( streams & STREAM_TEXCOORD )
+            {
+                glm::vec2 t = ( vertices[i].TexCoords - uvMin ) / uvRange;
+                GLushort packed[2] = { unorm16( t.x ), unorm16( t.y ) };
+                memcpy( vertex, packed, sizeof( packed ) );
+                vertex += sizeof( packed );
+            }
+        }
+
+        return Dequantization( bounds );
+    }
+
+    // The uniforms that unpack vertices Pack wrote against bounds, for data that was packed earlier (the mesh cache).
+    static VertexDequantization Dequantization( const QuantizationBounds &bounds )
+    {
+        glm::vec3 center, halfExtent;
+        glm::vec2 uvMin, uvRange;
+        quantizationRange( bounds, center, halfExtent, uvMin, uvRange );
+
+        VertexDequantization dequantization;
+        dequantization.positionScale = halfExtent / 32767.0f;
+        dequantization.positionOffset = center;
+        dequantization.texCoordTransform = glm::vec4( uvRange / 65535.0f, uvMin );
+        return dequantization;
+    }
+
+private:
+    // Positions map the bounds onto [-32767, 32767]; a flat axis still gets a usable scale
+    static void quantizationRange( const QuantizationBounds &bounds, glm::vec3 &center, glm::vec3 &halfExtent, glm::vec2 &uvMin,
+                                   glm::vec2 &uvRange )
+    {
+        center = ( bounds.positionMin + bounds.positionMax ) * 0.5f;
+        halfExtent = glm::max( ( bounds.positionMax - bounds.positionMin ) * 0.5f, glm::vec3( 1e-6f ) );
+        uvMin = bounds.texCoordMin;
+        uvRange = glm::max( bounds.texCoordMax - bounds.texCoordMin, glm::vec2( 1e-6f ) );
+    }
+
+    static void addAttribute( VertexLayout &layout, GLuint location, GLint components, GLenum type, GLsizei bytes )
+    {
+        VertexAttribute &attribute = layout.attributes[layout.attributeCount++];
+        attribute.location = location;
+        attribute.components = components;
+        attribute.type = type;
+        attribute.normalized = GL_FALSE;
+        attribute.offset = layout.stride;
+        layout.stride += bytes;
+    }
+
+    static GLshort snorm16( float value )
+    {
+        return ( GLshort )floor( glm::clamp( value, -1.0f, 1.0f ) * 32767.0f + 0.5f );
+    }
+
+    static GLushort unorm16( float value )
+    {
+        return ( GLushort )floor( glm::clamp( value, 0.0f, 1.0f ) * 65535.0f + 0.5f );
+    }
+
+    // Projects the unit normal onto the octahedron and unfolds the lower half, giving two values in [-1, 1].
+    static glm::vec2 octahedralEncode( glm::vec3 n )
+    {
+        float sum = fabs( n.x ) + fabs( n.y ) + fabs( n.z );
+        if( sum <= 0.0f )
+        {
+            return glm::vec2( 0.0f );
+        }
+        n /= sum;
+
+        glm::vec2 e( n.x, n.y );
+        if( n.z < 0.0f )
+        {
+            e = glm::vec2( ( 1.0f - fabs( n.y ) ) * ( n.x >= 0.0f ? 1.0f : -1.0f ),
+                           ( 1.0f - fabs( n.x ) ) * ( n.y >= 0.0f ? 1.0f : -1.0f ) );
+        }
+        return e;
+    }
+};
@@ -14,11 +14,24 @@
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "assetmanager.h"
+#include "frametimer.h"
+#include "glstate.h"
+#include "collisionhull.h"
+#include "collisionmesh.h"
+#include "physicsworld.h"
+#include "picking.h"
+#include "renderer.h"
+#include "simulation.h"
 #include "Texture.h"
+#include "textureloader.h"
 #include "skymap.h"
 // Standard Headers
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <irrKlang.h>
 #pragma comment(lib, "irrKlang.lib") // link with irrKlang.dll
@@ -29,16 +42,50 @@ int SCREEN_WIDTH, SCREEN_HEIGHT;
 // Function prototypes
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode);
 void MouseCallback(GLFWwindow *window, double xPos, double yPos);
-void DoMovement();
-void LoadModel(Shader shader, glm::mat4 projection, Model Model, Camera camera, glm::vec3 Pos);
-void LoadFloor(Shader shader, glm::mat4 projection, Model Model, Camera camera);
-void LoadTarget(Shader shader, glm::mat4 projection, Model Model, Camera camera, glm::vec3 Pos);
-void LoadBuilding(Shader shader, glm::mat4 projection, Model Model, Camera camera, glm::vec3 Pos);
-GLuint loadTexture(GLchar const * path);
+struct GameInput;
+void DoMovement(GameInput &input);
+glm::mat4 PlayerTransform(Camera &camera, glm::vec3 Pos);
+glm::mat4 FloorTransform();
+glm::mat4 TargetTransform(glm::vec3 Pos);
+glm::mat4 BuildingTransform(glm::vec3 Pos);
+void LegacyDraw(Shader &shader, glm::mat4 projection, Model &Model, Camera camera, glm::mat4 transform);
+TextureRef loadTexture(GLchar const * path);
+void DrawSkybox(void *context);
 GLuint loadCubemap(std::vector<std::string> faces);
 bool FirstCam = true;
+
+// What DrawSkybox needs, handed to the renderer as the sky packet's context
+struct SkyboxDraw {
+	GLuint vao;
+	GLuint cubemap;
+};
 int state = 0;
 
+// How far above the ground the first person eye is; the player model's origin is at its feet
+const GLfloat EYE_HEIGHT = 3.5f;
+
+// The game as one simulation tick leaves it, published to the renderer
+struct GameState {
+	glm::vec3 targets[6];
+	bool targetHit[6];
+	glm::vec3 player;
+	glm::vec3 eye;
+	bool firstPerson;
+	bool reverse;
+	bool right;
+	GLuint shotsTaken; // The last GameInput::shot a tick fired
+};
+// What the main thread samples from the window for the next simulation tick
+struct GameInput {
+	Camera camera; // Orientation the first person camera walks along
+	bool forward = false, backward = false, left = false, right = false;
+	bool firstPerson = true;
+	bool fire = false; // Latched on a click with its ray, until a tick has taken shot
+	GLuint shot = 0;
+	glm::vec3 rayOrigin;
+	glm::vec3 rayDirection;
+};
+
 void ScreenPosToWorldRay(
 	int mouseX, int mouseY,             // Mouse position, in pixels, from bottom-left corner of the window
 	int screenWidth, int screenHeight,  // Window size, in pixels
@@ -204,7 +251,125 @@ bool TestRayOBBIntersection(
 	return true;
 
 }
-Skymap Skybox;
+
+// Times the nearest hit of a batch of rays against targets random boxes: TestRayOBBIntersection on every box
+// against one OBBPicker::Pick, and checks that both pick the same box.
+void BenchmarkPicking(GLuint targets) {
+	const int rays = 256;
+	glm::vec3 aabb_min(-1.0f, -3.0f, -1.0f);
+	glm::vec3 aabb_max(1.0f, 3.0f, 1.0f);
+	glm::vec3 origin(0.0f, 0.0f, 0.0f);
+
+	srand(1);
+	std::vector<glm::mat4> models(targets);
+	OBBPicker benchPicker(targets);
+	for (GLuint i = 0; i < targets; i++) {
+		glm::vec3 pos((GLfloat)(rand() % 400 - 200), -2.0f, (GLfloat)(rand() % 400 - 200));
+		models[i] = glm::rotate(glm::translate(glm::mat4(), pos), (GLfloat)(rand() % 628) / 100.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+		benchPicker.Add(models[i], aabb_min, aabb_max);
+	}
+	std::vector<glm::vec3> directions(rays);
+	for (int r = 0; r < rays; r++)
+		directions[r] = glm::normalize(glm::vec3((GLfloat)(rand() % 200 - 100), (GLfloat)(rand() % 20 - 10) / 10.0f, (GLfloat)(rand() % 200 - 100)));
+
+	std::vector<GLint> scalarHits(rays);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rays; r++) {
+		GLint best = -1;
+		float bestDistance = 0.0f, distance;
+		for (GLuint i = 0; i < targets; i++) {
+			if (TestRayOBBIntersection(origin, directions[r], aabb_min, aabb_max, models[i], distance) && (best < 0 || distance < bestDistance)) {
+				best = (GLint)i;
+				bestDistance = distance;
+			}
+		}
+		scalarHits[r] = best;
+	}
+	double scalarSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	GLuint mismatches = 0, hits = 0;
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rays; r++) {
+		PickHit hit = benchPicker.Pick(origin, directions[r]);
+		mismatches += hit.index != scalarHits[r] ? 1 : 0;
+		hits += hit.index >= 0 ? 1 : 0;
+	}
+	double pickerSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("BENCH:: picking %u targets, %d rays (%u hit): scalar %.3f ms/ray, OBBPicker %.3f ms/ray (%.1fx), %u mismatches\n",
+		targets, rays, hits, scalarSeconds * 1000.0 / rays, pickerSeconds * 1000.0 / rays,
+		pickerSeconds > 0.0 ? scalarSeconds / pickerSeconds : 0.0, mismatches);
+}
+
+// Steps a world of rigid boxes dropped onto the ground on threads threads and returns the milliseconds per step.
+// The boxes stand apart, each one an island of its own, so the island solver has work to share out.
+double BenchmarkPhysics(GLuint bodies, unsigned threads) {
+	const int steps = 120;
+	const GLfloat step = 1.0f / 60.0f;
+	GLuint side = (GLuint)ceil(sqrt((double)bodies));
+	GLfloat spacing = 3.0f;
+
+	PhysicsWorld world(threads);
+	glm::vec3 groundHalf(side * spacing * 0.5f + 1.0f, 1.0f, side * spacing * 0.5f + 1.0f);
+	world.AddBox(glm::vec3(0.0f), groundHalf, glm::translate(glm::mat4(), glm::vec3(0.0f, -1.0f, 0.0f)), 0.0f, PHYSICS_STATIC);
+	for (GLuint i = 0; i < bodies; i++) {
+		glm::vec3 pos(((GLfloat)(i % side) - side * 0.5f) * spacing, 2.0f + (GLfloat)(i % 7) * 0.25f, ((GLfloat)(i / side) - side * 0.5f) * spacing);
+		glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(), pos), (GLfloat)(i % 628) / 100.0f, glm::vec3(0.3f, 1.0f, 0.2f));
+		world.AddBox(glm::vec3(0.0f), glm::vec3(0.5f, 1.5f, 0.5f), transform, 1.0f, PHYSICS_TARGET);
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < steps; i++)
+		world.Step(step, 1, step);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return seconds * 1000.0 / steps;
+}
+
+// Casts the same rays at a model placed by transform as a triangle mesh, as its convex hulls and as its bounds box,
+// and prints the time per ray and how often the hulls and the box disagree with the triangles about a hit.
+void BenchmarkProxyRays(Model &model, const CollisionHull &hull, const glm::mat4 &transform) {
+	const int rays = 4096;
+	CollisionMesh triangles(model);
+	PhysicsWorld meshWorld, hullWorld, boxWorld;
+	meshWorld.AddMesh(triangles, transform);
+	hullWorld.AddHull(hull, transform, PHYSICS_STATIC, false);
+	boxWorld.AddStatic(model, transform);
+
+	// From a sphere around the model at points inside its bounds, so a fair share of the rays graze it
+	glm::vec3 center(transform * glm::vec4(model.BoundsCenter(), 1.0f));
+	glm::vec3 extent(transform * glm::vec4(model.BoundsMax() - model.BoundsMin(), 0.0f));
+	GLfloat radius = glm::length(extent);
+	srand(1);
+	std::vector<glm::vec3> from(rays), to(rays);
+	for (int r = 0; r < rays; r++) {
+		glm::vec3 direction = glm::normalize(glm::vec3((GLfloat)(rand() % 200 - 100), (GLfloat)(rand() % 200 - 100), (GLfloat)(rand() % 200 - 100)) + glm::vec3(0.001f));
+		glm::vec3 aim((GLfloat)(rand() % 100) / 100.0f - 0.5f, (GLfloat)(rand() % 100) / 100.0f - 0.5f, (GLfloat)(rand() % 100) / 100.0f - 0.5f);
+		from[r] = center + direction * radius;
+		to[r] = center + aim * extent;
+		to[r] = from[r] + (to[r] - from[r]) * 2.0f;
+	}
+
+	PhysicsWorld *worlds[3] = { &meshWorld, &hullWorld, &boxWorld };
+	double ms[3];
+	std::vector<bool> hits[3];
+	for (int w = 0; w < 3; w++) {
+		hits[w].resize(rays);
+		RayHit hit;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rays; r++)
+			hits[w][r] = worlds[w]->RayTest(from[r], to[r], hit);
+		ms[w] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0 / rays;
+	}
+	GLuint meshHits = 0, hullWrong = 0, boxWrong = 0;
+	for (int r = 0; r < rays; r++) {
+		meshHits += hits[0][r] ? 1 : 0;
+		hullWrong += hits[1][r] != hits[0][r] ? 1 : 0;
+		boxWrong += hits[2][r] != hits[0][r] ? 1 : 0;
+	}
+	printf("BENCH:: %d rays at %s (%u hit its %u triangles): triangles %.4f ms/ray, %u-vertex hulls %.4f ms/ray (%u disagree), box %.4f ms/ray (%u disagree)\n",
+		rays, model.Path().c_str(), meshHits, triangles.TriangleCount(), ms[0], hull.VertexCount(), ms[1], hullWrong, ms[2], boxWrong);
+}
+
 // Camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 bool keys[1024];
@@ -214,19 +379,82 @@ bool firstMouse = true;
 glm::vec3 TestPos = glm::vec3(50.0f, -2.0f, 0.0f);
 glm::vec3 PlayerPos = glm::vec3(0.0f, -3.5f, 0.0f);
 
-GLfloat deltaTime = 0.0f;
-GLfloat lastFrame = 0.0f;
 
-
-bool Reverse = false;
-bool Right = false;
 bool Hit0 = false, Hit1 = false, Hit2 = false, Hit3 = false, Hit4 = false, Hit5 = false, Hit6 = false;
 bool OBJHit[6] = { false, false, false, false, false,false };
 
 int main(int argc, char * argv[]) {
 
+	// --bench-frames N plays N frames of the game scene without vsync, prints the CPU frame times and exits
+	// --bench-targets N adds N more targets on a grid to measure how target drawing scales
+	// --no-instancing draws the targets one by one instead of as one instanced batch, for comparison
+	// --no-lod draws every model at full detail, for comparison; --lod-pixels N sets the error allowed on screen (default 1)
+	// --bench-picking times nearest-target picking for 10k and 100k targets, scalar against OBBPicker, and exits
+	// --physics-threads N steps the physics world on N threads, 0 for all of them (default 1)
+	// --bench-physics times a physics step with 1k to 50k rigid targets for 1, 2, 4... threads, and exits
+	// --hull-vertices N caps the convex hulls the targets and the tower collide as at N vertices per mesh (default 32)
+	// --no-occlusion draws what is hidden behind the terrain and the tower too, for comparison
+	// --legacy-draw draws each object by itself the old way, the camera copied and the uniforms looked up per object, for comparison
+	GLuint benchFrames = 0;
+	GLuint benchTargets = 0;
+	bool instancing = true;
+	bool lod = true;
+	GLfloat lodPixels = 1.0f;
+	unsigned physicsThreads = 1;
+	GLuint hullVertices = DEFAULT_HULL_VERTICES;
+	bool occlusion = true;
+	bool legacyDraw = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench-frames") == 0 && i + 1 < argc)
+			benchFrames = (GLuint)atoi(argv[i + 1]);
+		if (strcmp(argv[i], "--bench-targets") == 0 && i + 1 < argc)
+			benchTargets = (GLuint)atoi(argv[i + 1]);
+		if (strcmp(argv[i], "--no-instancing") == 0)
+			instancing = false;
+		if (strcmp(argv[i], "--no-lod") == 0)
+			lod = false;
+		if (strcmp(argv[i], "--lod-pixels") == 0 && i + 1 < argc)
+			lodPixels = (GLfloat)atof(argv[i + 1]);
+		if (strcmp(argv[i], "--bench-picking") == 0) {
+			BenchmarkPicking(10000);
+			BenchmarkPicking(100000);
+			return EXIT_SUCCESS;
+		}
+		if (strcmp(argv[i], "--physics-threads") == 0 && i + 1 < argc)
+			physicsThreads = (unsigned)atoi(argv[i + 1]);
+		if (strcmp(argv[i], "--hull-vertices") == 0 && i + 1 < argc)
+			hullVertices = (GLuint)atoi(argv[i + 1]);
+		if (strcmp(argv[i], "--no-occlusion") == 0)
+			occlusion = false;
+		if (strcmp(argv[i], "--legacy-draw") == 0)
+			legacyDraw = true;
+		if (strcmp(argv[i], "--bench-physics") == 0) {
+			const GLuint counts[] = { 1000, 5000, 10000, 50000 };
+			unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+#if !BT_THREADSAFE
+			hardware = 1; // Bullet without thread locks only steps serially
+#endif
+			for (GLuint c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+				double serial = 0.0;
+				for (unsigned threads = 1; ; threads = std::min(threads * 2, hardware)) {
+					double ms = BenchmarkPhysics(counts[c], threads);
+					if (threads == 1)
+						serial = ms;
+					printf("BENCH:: physics %u bodies, %u threads: %.3f ms/step (%.1fx)\n", counts[c], threads, ms, ms > 0.0 ? serial / ms : 0.0);
+					if (threads == hardware)
+						break;
+				}
+			}
+			return EXIT_SUCCESS;
+		}
+	}
+	if (benchTargets > 0 && benchFrames == 0)
+		benchFrames = 500;
+
 	// Load GLFW and Create a Window
 	glfwInit();
+	// Terminates GLFW when main returns, after every GL resource declared below has been destroyed
+	struct GLFWSession { ~GLFWSession() { glfwTerminate(); } } glfwSession;
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -280,17 +508,17 @@ int main(int argc, char * argv[]) {
 		0, 1, 3, // First Triangle
 		1, 2, 3  // Second Triangle
 	};
-	GLuint VBO, VAO, EBO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+	GLVertexArray VAO = GLVertexArray::Create();
+	GLBuffer VBO = GLBuffer::Create();
+	GLBuffer EBO = GLBuffer::Create();
 
-	glBindVertexArray(VAO);
+	GLState &glState = GLState::Instance();
+	glState.BindVertexArray(VAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glState.BindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
 	// Position attribute
@@ -303,92 +531,29 @@ int main(int argc, char * argv[]) {
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
 	glEnableVertexAttribArray(2);
 
-	glBindVertexArray(0); // Unbind VAO
-
-
-						  // Load and create a texture 
-	GLuint texture1;
-	GLuint texture2;
-	GLuint texture3;
-	// ====================
-	// Texture 1
-	// ====================
-	glGenTextures(1, &texture1);
-	glBindTexture(GL_TEXTURE_2D, texture1); // All upcoming GL_TEXTURE_2D operations now have effect on our texture object
-											// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// Set texture wrapping to GL_REPEAT
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	int width, height;
-	unsigned char* image = stbi_load("./res/textures/Start.jpg", &width, &height, 0, STBI_rgb);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	stbi_image_free(image);
-	glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess up our texture.
-									 // ===================
-									 // Texture 2
-									 // ===================
-	glGenTextures(1, &texture2);
-	glBindTexture(GL_TEXTURE_2D, texture2);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = stbi_load("./res/textures/GoodEnd.jpg", &width, &height, 0, STBI_rgb);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	stbi_image_free(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindVertexArray(0); // Unbind VAO
-						  // ===================
-						  // Texture 3
-						  // ===================
-	glGenTextures(1, &texture3);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	// Set our texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// Set texture filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// Load, create texture and generate mipmaps
-	image = stbi_load("./res/textures/BadEnd.jpg", &width, &height, 0, STBI_rgb);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	stbi_image_free(image);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindVertexArray(0); // Unbind VAO
+	glState.BindVertexArray(0); // Unbind VAO
+
+
+						  // Load and create the screen textures, they are decoded on the worker pool while the rest of the scene loads
+	TextureRegistry &textures = TextureRegistry::Instance();
+	TextureRef texture1 = loadTexture("./res/textures/Start.jpg");
+	TextureRef texture2 = loadTexture("./res/textures/GoodEnd.jpg");
+	TextureRef texture3 = loadTexture("./res/textures/BadEnd.jpg");
 
 						  // Define the viewport dimensions
 	glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
 	// OpenGL options
 	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
+	glState.DepthFunc(GL_LESS);
 
 	// Setup and compile our shaders
 	//Shader shader("./res/shaders/cubemaps.vs", "./res/shaders/cubemaps.frag");
 	Shader skyboxShader("./res/shaders/skybox.vs", "./res/shaders/skybox.frag");
 
 	Shader Modelshader("./res/shaders/shader.vs", "./res/shaders/shader.frag");
-	// Load models
-	Model ourModel("./res/objects/nanosuit/nanosuit.obj");
-	Model MountModel("./res/objects/Mount/terrain 1 low polly.obj");
-	Model TargetModel("./res/objects/cyborg/cyborg.obj");
-	Model TargetBul("./res/objects/Wooden-Watch-Tower/wooden watch tower2.obj");
-
-
-	 //Setup skybox VAO
-	GLuint skyboxVAO = 0, skyboxVBO = 0;
-	Skybox.CreateBuffers(skyboxVAO, skyboxVBO);
-	skyboxVAO = Skybox.GetVAO();
-	skyboxVBO = Skybox.GetVBO();
+	// Same shading, model matrices come from the per-instance attributes
+	Shader ModelInstancedShader("./res/shaders/shader_instanced.vs", "./res/shaders/shader.frag");
 
 	// Cubemap (Skybox)
 	std::vector<std::string> faces;
@@ -398,11 +563,36 @@ int main(int argc, char * argv[]) {
 	faces.push_back("./res/textures/skybox/bottom.jpg");
 	faces.push_back("./res/textures/skybox/back.jpg");
 	faces.push_back("./res/textures/skybox/front.jpg");
-	GLuint skyboxTexture = loadCubemap(faces);
+	GLTexture skyboxTexture(loadCubemap(faces));
+
+	// Load models
+	// Only upload the vertex streams the model shader reads
+	VertexStreamMask modelStreams = Modelshader.ActiveStreams();
+	AssetManager &assets = AssetManager::Instance();
+	std::shared_ptr<Model> ourModel = assets.LoadModel("./res/objects/nanosuit/nanosuit.obj", modelStreams);
+	std::shared_ptr<Model> MountModel = assets.LoadModel("./res/objects/Mount/terrain 1 low polly.obj", modelStreams);
+	std::shared_ptr<Model> TargetModel = assets.LoadModel("./res/objects/cyborg/cyborg.obj", modelStreams);
+	std::shared_ptr<Model> TargetBul = assets.LoadModel("./res/objects/Wooden-Watch-Tower/wooden watch tower2.obj", modelStreams);
+	ourModel->BakeMaterials(Modelshader);
+	MountModel->BakeMaterials(Modelshader);
+	TargetModel->BakeMaterials(Modelshader);
+	TargetModel->BakeMaterials(ModelInstancedShader);
+	TargetBul->BakeMaterials(Modelshader);
+	// The terrain and the tower hide targets. Both are flat shaded, every vertex is a seam the simplifier
+	// keeps, so they have no coarser levels and go into the occlusion buffer at full detail
+	MountModel->SetOccluder(true);
+	TargetBul->SetOccluder(true);
+	TextureLoader::Instance().Flush();
+	TextureLoader::Instance().PrintReport();
+	assets.PrintReport();
+	GeometryArena::PrintReport();
+
+
+	 //Setup skybox VAO
+	Skymap skybox;
+	skybox.CreateBuffers();
+	GLuint skyboxVAO = skybox.GetVAO();
 
-	//Picking
-	glm::quat orientations;
-	orientations = glm::normalize(glm::quat(glm::vec3(0.0f, 0.0f, 0.0f)));
 
 	// Generate positions  
 	std::vector<glm::vec3> positions(6);
@@ -422,25 +612,171 @@ int main(int argc, char * argv[]) {
 	positionsCopy[5] = glm::vec3(-150.17, -2.00, -53.67);
 	//positionsCopy[6] = glm::vec3(-150.17, -2.00, 26.99);
 
+	// Convex hulls for the targets and the tower, triangles for the terrain; all cached next to the models
+	CollisionHull targetHull(*TargetModel, hullVertices);
+	CollisionHull towerHull(*TargetBul, hullVertices);
+	CollisionMesh terrainCollision(*MountModel);
+	targetHull.PrintReport();
+	towerHull.PrintReport();
+	terrainCollision.PrintReport();
+
+	// Collision shapes placed where the models are drawn
+	PhysicsWorld physics(physicsThreads);
+	BodyId targetBodies[6];
+	for (int i = 0; i < 6; i++)
+		targetBodies[i] = physics.AddHull(targetHull, TargetTransform(positions[i]), PHYSICS_TARGET, true);
+	physics.AddHull(towerHull, BuildingTransform(TestPos), PHYSICS_STATIC, false);
+	physics.AddMesh(terrainCollision, FloorTransform(), PHYSICS_TERRAIN);
+
+	// Target patrols, player movement, shots and Bullet run on their own thread at a fixed rate. The
+	// physics world and positionsCopy belong to it from Start on; the loop below only blends its snapshots.
+	GameState initialGame;
+	for (int i = 0; i < 6; i++) {
+		initialGame.targets[i] = positions[i];
+		initialGame.targetHit[i] = false;
+	}
+	initialGame.player = PlayerPos;
+	initialGame.eye = camera.GetPosition();
+	initialGame.firstPerson = FirstCam;
+	initialGame.reverse = false;
+	initialGame.right = false;
+	initialGame.shotsTaken = 0;
+	Simulation<GameState, GameInput> simulation(initialGame, [&](GameState &game, const GameInput &input, GLfloat step) {
+		// Walk the player, and the camera with it in first person
+		if (input.firstPerson && !game.firstPerson)
+			game.eye = game.player;
+		game.firstPerson = input.firstPerson;
+		Camera walker = input.camera;
+		walker.setPos(game.eye);
+		if (input.forward) {
+			if (game.firstPerson)
+				walker.ProcessKeyboard(FORWARD, step);
+			game.player.z -= 10.0f*step;
+		}
+		if (input.backward) {
+			if (game.firstPerson)
+				walker.ProcessKeyboard(BACKWARD, step);
+			game.player.z += 10.0f*step;
+		}
+		if (input.left) {
+			if (game.firstPerson)
+				walker.ProcessKeyboard(LEFT, step);
+			game.player.x -= 10.0f*step;
+		}
+		if (input.right) {
+			if (game.firstPerson)
+				walker.ProcessKeyboard(RIGHT, step);
+			game.player.x += 10.0f*step;
+		}
+		GLfloat eyeHeight = game.eye.y;
+		game.eye = walker.GetPosition();
+
+		// Keep the eye and the player on the terrain below them. Off the terrain the eye keeps its height,
+		// the walk only moves it across: looking up or down must not make it fly or dig.
+		RayHit ground;
+		if (game.firstPerson) {
+			if (physics.RayTest(game.eye + glm::vec3(0.0f, 200.0f, 0.0f), game.eye - glm::vec3(0.0f, 200.0f, 0.0f), ground, PHYSICS_TERRAIN))
+				game.eye.y = ground.point.y + EYE_HEIGHT;
+			else
+				game.eye.y = eyeHeight;
+		}
+		if (physics.RayTest(game.player + glm::vec3(0.0f, 200.0f, 0.0f), game.player - glm::vec3(0.0f, 200.0f, 0.0f), ground, PHYSICS_TERRAIN))
+			game.player.y = ground.point.y;
+
+		// The targets patrol back and forth along z
+		for (int i = 0; i < 6; i++)
+			game.targets[i].z += (game.reverse ? -5.0f : 5.0f)*step;
+		if (game.targets[0].z > positionsCopy[0].z + 20.0f)
+			game.reverse = true;
+		else if (game.targets[0].z < positionsCopy[0].z - 20.0f)
+			game.reverse = false;
+		if (game.targets[0].x > positionsCopy[0].x + 10.0f)
+			game.right = true;
+		else if (game.targets[0].x < positionsCopy[0].x - 10.0f)
+			game.right = false;
+		for (int i = 0; i < 6; i++)
+			physics.SetTransform(targetBodies[i], TargetTransform(game.targets[i]));
+
+		// The nearest body along the ray is hit, so the tower shields targets behind it.
+		// Targets that were hit leave the world and can't be hit again.
+		RayHit hit;
+		if (input.fire && input.shot != game.shotsTaken) {
+			game.shotsTaken = input.shot;
+			if (physics.RayTest(input.rayOrigin, input.rayOrigin + input.rayDirection * 100.0f, hit)) {
+				for (int i = 0; i < 6; i++) {
+					if (targetBodies[i] == hit.body) {
+						game.targetHit[i] = true;
+						physics.SetEnabled(hit.body, false);
+						printf("Collision ");
+					}
+				}
+			}
+		}
+
+		physics.Step(step, 1, step);
+	});
+	GameState previousGame, currentGame;
+	GameInput gameInput;
+	bool fireHeld = false;
+
+	// Screen samplers, resolved once so the loop never looks uniforms up by name
+	UniformId startSampler = BoxShader.Uniform("ourTexture1");
+	UniformId goodEndSampler = BoxShader3.Uniform("ourTexture2");
+	UniformId badEndSampler = BoxShader2.Uniform("ourTexture1");
+
+	// Target transforms for the instanced batch. The bench targets never move, so they are built once.
+	std::vector<glm::mat4> benchTargetTransforms;
+	GLuint gridSide = (GLuint)ceil(sqrt((double)benchTargets));
+	for (GLuint i = 0; i < benchTargets; i++) {
+		glm::vec3 gridPos((GLfloat)(i % gridSide) - gridSide * 0.5f, 0.0f, (GLfloat)(i / gridSide) - gridSide * 0.5f);
+		benchTargetTransforms.push_back(TargetTransform(glm::vec3(gridPos.x * 6.0f, -2.0f, gridPos.z * 6.0f)));
+	}
+	std::vector<glm::mat4> targetTransforms;
+	targetTransforms.reserve(positions.size() + benchTargets);
+
+	// Scene drawing, the frame loop only submits draw packets
+	SkyboxDraw skyboxDraw = { skyboxVAO, skyboxTexture };
+	CameraUniforms cameraUniforms;
+	Renderer renderer;
+	renderer.SetLod(lod, lodPixels, (GLfloat)mHeight);
+	renderer.SetOcclusion(occlusion);
+	FrameTimer frameTimer;
+	// Triangles drawn over the benchmark, and what they would have been at full detail
+	unsigned long long drawnTriangles = 0, fullDetailTriangles = 0;
+	// Instances occlusion culling tested and hid over the benchmark, and the time spent rasterizing occluders
+	unsigned long long occlusionTested = 0, occlusionHidden = 0;
+	double occlusionSeconds = 0.0;
+	if (benchFrames > 0) {
+		state = 1;
+		glfwSwapInterval(0);
+		glfwSetTime(0.0);
+	}
+	simulation.SetInput(gameInput);
+	simulation.Start();
 
 	// Rendering Loop
 	while (glfwWindowShouldClose(mWindow) == false) {
+		frameTimer.BeginFrame();
+		glState.BeginFrame();
 		if (glfwGetKey(mWindow, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(mWindow, true);
 
-		// Set frame time
-		GLfloat currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
 		glfwPollEvents();
-		DoMovement();
+
+		// Blend the two newest simulation ticks for this frame
+		GLfloat blend = simulation.Sample(previousGame, currentGame);
+		for (int i = 0; i < 6; i++) {
+			positions[i] = glm::mix(previousGame.targets[i], currentGame.targets[i], blend);
+			OBJHit[i] = currentGame.targetHit[i];
+		}
+		PlayerPos = glm::mix(previousGame.player, currentGame.player, blend);
+		if (FirstCam && previousGame.firstPerson && currentGame.firstPerson)
+			camera.setPos(glm::mix(previousGame.eye, currentGame.eye, blend));
 
 		//picking
-		glm::vec3 out_origin1;
-		glm::vec3 out_direction1;
 		glm::mat4 view = camera.GetViewMatrix();
 		glm::mat4 projection = glm::perspective(camera.GetZoom(), (float)mWidth / (float)mHeight, 0.1f, 1000.0f);
+		cameraUniforms.Update(view, projection, camera.GetPosition(), (GLfloat)glfwGetTime());
 
 
 		// Camera controls
@@ -467,100 +803,27 @@ int main(int argc, char * argv[]) {
 		// PICKING IS DONE HERE
 		// (Instead of picking each frame if the mouse button is down, 
 		// you should probably only check if the mouse button was just released)
-
-
-		if (!Reverse) {
-			for (int i = 0; i < 6; i++) {
-				positions[i].z += 5.0f*deltaTime;
-			}
-		}
-		else if (Reverse) {
-			for (int i = 0; i < 6; i++) {
-				positions[i].z -= 5.0f*deltaTime;
-			}
-		}
-
-		if (positions[0].z>positionsCopy[0].z + 20.0f) {
-			Reverse = true;
-		}
-		else if (positions[0].z<positionsCopy[0].z - 20.0f) {
-			Reverse = false;
-		}
-		if (positions[0].x>positionsCopy[0].x + 10.0f) {
-			Right = true;
-		}
-		else if (positions[0].x<positionsCopy[0].x - 10.0f) {
-			Right = false;
-		}
-
-
-		if (glfwGetMouseButton(mWindow, GLFW_MOUSE_BUTTON_LEFT)) {
-
-			glm::vec3 ray_origin;
-			glm::vec3 ray_direction;
+		// A click is latched until a simulation tick has taken the shot, ticks are rarer than frames
+		DoMovement(gameInput);
+		gameInput.camera = camera;
+		gameInput.firstPerson = FirstCam;
+		if (gameInput.fire && currentGame.shotsTaken == gameInput.shot)
+			gameInput.fire = false;
+		bool fireDown = glfwGetMouseButton(mWindow, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		if (fireDown && !fireHeld && !gameInput.fire) {
+			gameInput.fire = true;
+			gameInput.shot++;
 			ScreenPosToWorldRay(
 				1024 / 2, 768 / 2,
 				1024, 768,
 				view,
 				projection,
-				ray_origin,
-				ray_direction
+				gameInput.rayOrigin,
+				gameInput.rayDirection
 			);
-
-
-			for (int i = 0; i<6; i++) {
-
-				float intersection_distance; // Output of TestRayOBBIntersection()
-				glm::vec3 aabb_min(-1.0f, -3.0f, -1.0f);
-				glm::vec3 aabb_max(1.0f, 3.0f, 1.0f);
-
-				// The ModelMatrix transforms :
-				// - the mesh to its desired position and orientation
-				// - but also the AABB (defined with aabb_min and aabb_max) into an OBB
-				glm::mat4 RotationMatrix = glm::toMat4(orientations);
-				glm::mat4 TranslationMatrix = translate(glm::mat4(), positions[i]);
-				glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
-
-
-				if (TestRayOBBIntersection(
-					ray_origin,
-					ray_direction,
-					aabb_min,
-					aabb_max,
-					ModelMatrix,
-					intersection_distance)
-					) {
-					if (i == 0) {
-						OBJHit[1] = true;
-					}
-					if (i == 1) {
-						//Hit1 = true;
-						OBJHit[2] = true;
-					}
-					if (i == 2) {
-						//Hit2 = true;
-						OBJHit[3] = true;
-					}
-					if (i == 3) {
-						//Hit3 = true;
-						OBJHit[4] = true;
-					}
-					if (i == 4) {
-						//Hit4 = true;
-						OBJHit[5] = true;
-					}if (i == 5) {
-						//Hit5 = true;
-						OBJHit[6] = true;
-
-					}
-
-					printf("Collision ");
-					break;
-				}
-			}
-
-
 		}
+		fireHeld = fireDown;
+		simulation.SetInput(gameInput);
 		//double time = glfwGetTime();
 		//printf("time  <%.2f> \n", time);
 
@@ -569,152 +832,186 @@ int main(int argc, char * argv[]) {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		if (state == 0) {
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texture1);
-			glUniform1i(glGetUniformLocation(BoxShader.Program, "ourTexture1"), 0);
+			glState.ActiveTexture(GL_TEXTURE0);
+			glState.BindTexture(GL_TEXTURE_2D, textures.Id(texture1));
 
 
 			// Activate shader
 			BoxShader.Use();
+			BoxShader.Set(startSampler, 0);
 
 			// Draw container
-			glBindVertexArray(VAO);
+			glState.BindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
 		}
 
 
-		if (state == 1) {
-			glm::mat4 model;
-
-			glDepthFunc(GL_LEQUAL);  // Change depth function so depth test passes when values are equal to depth buffer's content
+		if (state == 1 && legacyDraw) {
+			// No queue, no culling and no LOD: every object binds and draws on its own, the sky last
+			for (int i = 0; i < 6; i++) {
+				if (OBJHit[i] == false)
+					LegacyDraw(Modelshader, projection, *TargetModel, camera, TargetTransform(positions[i]));
+			}
+			for (size_t i = 0; i < benchTargetTransforms.size(); i++)
+				LegacyDraw(Modelshader, projection, *TargetModel, camera, benchTargetTransforms[i]);
+			LegacyDraw(Modelshader, projection, *ourModel, camera, PlayerTransform(camera, PlayerPos));
+			LegacyDraw(Modelshader, projection, *TargetBul, camera, BuildingTransform(TestPos));
+			LegacyDraw(Modelshader, projection, *MountModel, camera, FloorTransform());
 			skyboxShader.Use();
-			view = glm::mat4(glm::mat3(camera.GetViewMatrix()));	// Remove any translation component of the view matrix
-			glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-			glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-			// skybox cube
-			glBindVertexArray(skyboxVAO);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-			glBindVertexArray(0);
-			glDepthFunc(GL_LESS);  //Set depth function back to default
+			DrawSkybox(&skyboxDraw);
+		}
+		else if (state == 1) {
+			// The queue sorts these by program, material, VAO and depth; the sky pass is drawn last
+			renderer.Begin(view, projection);
+			targetTransforms.clear();
 			for (int i = 0; i < 6; i++) {
-				if(OBJHit[i+1] == false)
-				LoadTarget(Modelshader, projection, TargetModel, camera, positions[i]);
+				if(OBJHit[i] == false)
+				targetTransforms.push_back(TargetTransform(positions[i]));
+			}
+			targetTransforms.insert(targetTransforms.end(), benchTargetTransforms.begin(), benchTargetTransforms.end());
+			if (instancing) {
+				renderer.Submit(*TargetModel, targetTransforms.data(), (GLuint)targetTransforms.size(), ModelInstancedShader);
 			}
-			LoadModel(Modelshader, projection, ourModel, camera, PlayerPos);
-			LoadBuilding(Modelshader, projection, TargetBul, camera, TestPos);
-			LoadFloor(Modelshader, projection, MountModel, camera);
+			else {
+				for (size_t i = 0; i < targetTransforms.size(); i++)
+					renderer.Submit(*TargetModel, targetTransforms[i], Modelshader);
+			}
+			renderer.Submit(*ourModel, PlayerTransform(camera, PlayerPos), Modelshader);
+			renderer.Submit(*TargetBul, BuildingTransform(TestPos), Modelshader);
+			renderer.Submit(*MountModel, FloorTransform(), Modelshader);
+			renderer.Submit(PASS_SKY, skyboxShader, DrawSkybox, &skyboxDraw);
+			renderer.Flush();
+			drawnTriangles += renderer.Stats().triangles;
+			fullDetailTriangles += renderer.Stats().fullDetailTriangles;
+			occlusionTested += renderer.Occlusion().tested;
+			occlusionHidden += renderer.Occlusion().occluded;
+			occlusionSeconds += renderer.Occlusion().rasterSeconds;
 
 			double time = glfwGetTime();
 			if (time >= 60.0) {
 				state = 3;
 			}
-			if (OBJHit[1]&& OBJHit[2] && OBJHit[3] && OBJHit[4] && OBJHit[5] && OBJHit[6]) {
+			if (OBJHit[0] && OBJHit[1] && OBJHit[2] && OBJHit[3] && OBJHit[4] && OBJHit[5]) {
 				state = 2;
 			}
 		}
 
 		if (state == 2) {
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, texture2);
-			glUniform1i(glGetUniformLocation(BoxShader3.Program, "ourTexture2"), 1);
+			glState.ActiveTexture(GL_TEXTURE1);
+			glState.BindTexture(GL_TEXTURE_2D, textures.Id(texture2));
 
 
 			// Activate shader
 			BoxShader3.Use();
+			BoxShader3.Set(goodEndSampler, 1);
 
 			// Draw container
-			glBindVertexArray(VAO);
+			glState.BindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
 		}
 		if (state == 3) {
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, texture3);
-			glUniform1i(glGetUniformLocation(BoxShader2.Program, "ourTexture1"), 2);
+			glState.ActiveTexture(GL_TEXTURE2);
+			glState.BindTexture(GL_TEXTURE_2D, textures.Id(texture3));
 
 
 			// Activate shader
 			BoxShader2.Use();
+			BoxShader2.Set(badEndSampler, 2);
 
 			// Draw container
-			glBindVertexArray(VAO);
+			glState.BindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
+		}
+
+		frameTimer.EndFrame();
+		if (benchFrames > 0 && frameTimer.Frames() >= benchFrames) {
+			const char *labels[2][2] = { { "scene (individual targets, no LOD)", "scene (individual targets)" },
+				{ "scene (instanced targets, no LOD)", "scene (instanced targets)" } };
+			frameTimer.PrintReport(legacyDraw ? "scene (legacy per-object draws)" : labels[instancing][lod]);
+			glState.PrintReport();
+			printf("BENCH:: %u instances, %u meshes in %u draws, %u program changes per frame\n", renderer.Stats().instances,
+				renderer.Stats().meshes, renderer.Stats().batches, renderer.Stats().programChanges);
+			printf("BENCH:: culling tested %u, culled %u\n", renderer.Culling().tested, renderer.Culling().culled);
+			const RenderStats &stats = renderer.Stats();
+			printf("BENCH:: LOD %.0f triangles per frame of %.0f at full detail (%.1f%%), last frame instances per level %u/%u/%u/%u\n",
+				(double)drawnTriangles / frameTimer.Frames(), (double)fullDetailTriangles / frameTimer.Frames(),
+				fullDetailTriangles > 0 ? 100.0 * drawnTriangles / fullDetailTriangles : 100.0,
+				stats.lodInstances[0], stats.lodInstances[1], stats.lodInstances[2], stats.lodInstances[3]);
+			const OcclusionStats &occluded = renderer.Occlusion();
+			printf("BENCH:: occlusion %.1f of %.1f instances hidden per frame, %.3f ms rasterizing, last frame %u occluders with %u triangles\n",
+				(double)occlusionHidden / frameTimer.Frames(), (double)occlusionTested / frameTimer.Frames(),
+				occlusionSeconds * 1000.0 / frameTimer.Frames(), occluded.occluders, occluded.triangles);
+			// The physics world is the main thread's again once the simulation has stopped
+			simulation.Stop();
+			printf("BENCH:: simulation %u ticks at %.0f Hz\n", simulation.Ticks(), 1.0f / simulation.Step());
+			GLuint visibleTargets = 0;
+			for (int i = 0; i < 6; i++)
+				visibleTargets += !OBJHit[i] && physics.LineOfSight(camera.GetPosition(), targetBodies[i]) ? 1 : 0;
+			printf("BENCH:: %u physics bodies, %u targets in line of sight\n", physics.BodyCount(), visibleTargets);
+			BenchmarkProxyRays(*TargetModel, targetHull, TargetTransform(positions[0]));
+			BenchmarkProxyRays(*TargetBul, towerHull, BuildingTransform(TestPos));
+			glfwSetWindowShouldClose(mWindow, true);
 		}
 
 		// Flip Buffers and Draw
 		glfwSwapBuffers(mWindow);
 		
 	}  
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
+	// The manager is a static that outlives glfwSession, release its models while the context is still alive
+	assets.Clear();
 
-	glfwTerminate();
 	return EXIT_SUCCESS;
 }
 
-GLuint loadCubemap(std::vector<std::string> faces)
+// The draw path from before the render queue, kept for --legacy-draw: the camera is copied and the
+// uniforms are looked up by name for every object. The view and projection live in the camera block now,
+// they are still uploaded here so the per-object cost stays what it was.
+void LegacyDraw(Shader &shader, glm::mat4 projection, Model &Model, Camera camera, glm::mat4 transform)
 {
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	glActiveTexture(GL_TEXTURE0);
+	shader.Use();
+	glm::mat4 view = camera.GetViewMatrix();
+	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(transform));
+	Model.Draw(shader);
+}
 
-	int width, height;
-	unsigned char* image;
+// Draws the sky cube after the opaque scene. Its depth is forced to 1.0, so with LEQUAL only
+// pixels nothing else covered are shaded.
+void DrawSkybox(void *context)
+{
+	const SkyboxDraw *sky = (const SkyboxDraw *)context;
+	GLState &glState = GLState::Instance();
+	glState.DepthFunc(GL_LEQUAL);
+	glState.BindVertexArray(sky->vao);
+	glState.ActiveTexture(GL_TEXTURE0);
+	glState.BindTexture(GL_TEXTURE_CUBE_MAP, sky->cubemap);
+	glDrawArrays(GL_TRIANGLES, 0, 36);
+	glState.DepthFunc(GL_LESS);
+}
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-	for (GLuint i = 0; i < faces.size(); i++)
-	{
-		image = stbi_load(faces[i].c_str(), &width, &height, 0, STBI_rgb);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-	return textureID;
+GLuint loadCubemap(std::vector<std::string> faces)
+{
+	// The faces are decoded in parallel and uploaded on the next TextureLoader flush
+	return TextureLoader::Instance().LoadCubemap(faces);
 }
 
 
 // This function loads a texture from file. Note: texture loading functions like these are usually 
 // managed by a 'Resource Manager' that manages all resources (like textures, models, audio). 
 // For learning purposes we'll just define it as a utility function.
-GLuint loadTexture(GLchar const * path)
+TextureRef loadTexture(GLchar const * path)
 {
-	//Generate texture ID and load texture data 
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	int width, height;
-	unsigned char* image = stbi_load(path, &width, &height, 0, STBI_rgb);
-	// Assign texture to ID
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	// Parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	stbi_image_free(image);
-	return textureID;
+	// Shared with the models through the registry, the image is decoded on the worker pool and uploaded on the next flush
+	return TextureRef(TextureRegistry::Instance().Acquire(path));
 }
 
-void LoadModel(Shader shader, glm::mat4 projection, Model Model, Camera camera, glm::vec3 Pos) {
-	glm::mat4 view = camera.GetViewMatrix();
+// Model matrices for the scene objects, submitted to the Renderer each frame
+glm::mat4 PlayerTransform(Camera &camera, glm::vec3 Pos) {
 	glm::mat4 model;
 	glm::vec3 Viewtest = camera.GetView();
 	GLfloat yaw = camera.GetYAW();
 
-	shader.Use();
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
 	// Draw the loaded model//fix for not dependint on cam
 	if (FirstCam) {
 		model = glm::translate(model, glm::vec3(Viewtest.x, Viewtest.y - 3.5f, Viewtest.z));
@@ -726,80 +1023,36 @@ void LoadModel(Shader shader, glm::mat4 projection, Model Model, Camera camera,
 	// Translate it down a bit so it's at the center of the scene
 	model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));	// It's a bit too big for our scene, so scale it down
 	model = glm::rotate(model, -glm::radians(yaw) - (-glm::radians(90.0f)), glm::vec3(0, 1, 0));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	Model.Draw(shader);
-
+	return model;
 }
-void LoadTarget(Shader shader, glm::mat4 projection, Model Model, Camera camera, glm::vec3 Pos) {
-	glm::mat4 view = camera.GetViewMatrix();
+glm::mat4 TargetTransform(glm::vec3 Pos) {
 	glm::mat4 model;
-	shader.Use();
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	// Draw the loaded model//fix for not dependint on cam
 	model = glm::translate(model, glm::vec3(Pos.x, Pos.y - 3.0f, Pos.z)); // Translate it down a bit so it's at the center of the scene
 	model = glm::scale(model, glm::vec3(2.3f, 2.3f, 2.3f));	// It's a bit too big for our scene, so scale it down
 															//model = glm::rotate(model, -glm::radians(yaw) - (-glm::radians(90.0f)), glm::vec3(0, 1, 0));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	Model.Draw(shader);
-
+	return model;
 }
-void LoadBuilding(Shader shader, glm::mat4 projection, Model Model, Camera camera, glm::vec3 Pos) {
-	glm::mat4 view = camera.GetViewMatrix();
+glm::mat4 BuildingTransform(glm::vec3 Pos) {
 	glm::mat4 model;
-	shader.Use();
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	// Draw the loaded model//fix for not dependint on cam
 	model = glm::translate(model, glm::vec3(Pos.x, Pos.y - 3.0f, Pos.z)); // Translate it down a bit so it's at the center of the scene
 	model = glm::scale(model, glm::vec3(3.0f, 3.0f, 3.0f));	// It's a bit too big for our scene, so scale it down
-															//model = glm::rotate(model, -glm::radians(yaw) - (-glm::radians(90.0f)), glm::vec3(0, 1, 0));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	Model.Draw(shader);
-
+	return model;
 }
-void LoadFloor(Shader shader, glm::mat4 projection, Model Model, Camera camera) {
-	glm::mat4 view1 = camera.GetViewMatrix();
+glm::mat4 FloorTransform() {
 	glm::mat4 model1;
-	glm::vec3 Viewtest = camera.GetView();
-	shader.Use();
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view1));
-	// Draw the loaded model
 	model1 = glm::translate(model1, glm::vec3(1.0f, -10.0f, 1.0f)); // Translate it down a bit so it's at the center of the scene
 	model1 = glm::scale(model1, glm::vec3(10.0f, 10.0f, 10.0f));	// It's a bit too big for our scene, so scale it down
-	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model1));
-	Model.Draw(shader);
-
+	return model1;
 }
 // Moves/alters the camera positions based on user input
-void DoMovement()
+// Samples the movement keys for the next simulation tick
+void DoMovement(GameInput &input)
 {
 	// Camera controls
-	if (keys[GLFW_KEY_W]) {
-		if (FirstCam) {
-			camera.ProcessKeyboard(FORWARD, deltaTime);
-		}
-		PlayerPos.z -= 10.0f*deltaTime;
-	}
-	if (keys[GLFW_KEY_S]) {
-		if (FirstCam) {
-			camera.ProcessKeyboard(BACKWARD, deltaTime);
-		}
-		PlayerPos.z += 10.0f*deltaTime;
-	}
-	if (keys[GLFW_KEY_A]) {
-		if (FirstCam) {
-			camera.ProcessKeyboard(LEFT, deltaTime);
-		}
-		PlayerPos.x -= 10.0f*deltaTime;
-	}
-	if (keys[GLFW_KEY_D]) {
-		if (FirstCam) {
-			camera.ProcessKeyboard(RIGHT, deltaTime);
-		}
-		PlayerPos.x += 10.0f*deltaTime;
-	}
+	input.forward = keys[GLFW_KEY_W];
+	input.backward = keys[GLFW_KEY_S];
+	input.left = keys[GLFW_KEY_A];
+	input.right = keys[GLFW_KEY_D];
 }
 
 // Is called whenever a key is pressed/released via GLFW
@@ -53,7 +53,16 @@ in vec2 TexCoords;
 
 out vec4 color;
 
-uniform vec3 viewPos;
+// Filled once per frame by CameraUniforms
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
+
 uniform DirLight dirLight;
 uniform PointLight pointLights[NUMBER_OF_POINT_LIGHTS];
 uniform SpotLight spotLight;
@@ -68,7 +77,7 @@ void main( )
 {
     // Properties
     vec3 norm = normalize( Normal );
-    vec3 viewDir = normalize( viewPos - FragPos );
+    vec3 viewDir = normalize( cameraPos - FragPos );
     
     // Directional lighting
     vec3 result = CalcDirLight( dirLight, norm, viewDir );
@@ -1,6 +1,6 @@
 #version 330 core
 layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
+layout (location = 1) in vec2 normal;
 layout (location = 2) in vec2 texCoords;
 
 out vec3 Normal;
@@ -8,13 +8,37 @@ out vec3 FragPos;
 out vec2 TexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Filled once per frame by CameraUniforms
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
+
+// Mesh vertices are quantized to 16 bit integers, see QuantizedVertexFormat
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform vec4 texCoordTransform;
+
+// Unfolds an octahedral encoded normal
+vec3 decodeNormal(vec2 packed)
+{
+    vec2 e = packed / 32767.0f;
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f)
+        n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    return normalize(n);
+}
 
 void main()
 {
-    gl_Position = projection * view *  model * vec4(position, 1.0f);
-    FragPos = vec3(model * vec4(position, 1.0f));
-    Normal = mat3(transpose(inverse(model))) * normal;
-    TexCoords = texCoords;
+    vec3 objectPos = position * positionScale + positionOffset;
+    gl_Position = viewProjection * model * vec4(objectPos, 1.0f);
+    FragPos = vec3(model * vec4(objectPos, 1.0f));
+    Normal = mat3(transpose(inverse(model))) * decodeNormal(normal);
+    TexCoords = texCoords * texCoordTransform.xy + texCoordTransform.zw;
 }
\ No newline at end of file
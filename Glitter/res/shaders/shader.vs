@@ -1,16 +1,29 @@
 #version 330 core
 layout (location = 0) in vec3 position;
-// layout (location = 1) in vec3 normal;
+// layout (location = 1) in vec2 normal;
 layout (location = 2) in vec2 texCoords;
 
 out vec2 TexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Filled once per frame by CameraUniforms
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
+
+// Mesh vertices are quantized to 16 bit integers, see QuantizedVertexFormat
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform vec4 texCoordTransform;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f);
-    TexCoords = texCoords;
+    gl_Position = viewProjection * model * vec4(position * positionScale + positionOffset, 1.0f);
+    TexCoords = texCoords * texCoordTransform.xy + texCoordTransform.zw;
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+// layout (location = 1) in vec2 normal;
+layout (location = 2) in vec2 texCoords;
+// One model matrix per instance, see InstanceLayout
+layout (location = 3) in mat4 instanceModel;
+
+out vec2 TexCoords;
+
+// Filled once per frame by CameraUniforms
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
+
+// Mesh vertices are quantized to 16 bit integers, see QuantizedVertexFormat
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform vec4 texCoordTransform;
+
+void main()
+{
+    gl_Position = viewProjection * instanceModel * vec4(position * positionScale + positionOffset, 1.0f);
+    TexCoords = texCoords * texCoordTransform.xy + texCoordTransform.zw;
+}
\ No newline at end of file
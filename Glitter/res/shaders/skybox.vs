@@ -2,13 +2,20 @@
 layout (location = 0) in vec3 position;
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
-
+// Filled once per frame by CameraUniforms
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
 
 void main()
 {
-    vec4 pos = projection * view * vec4(position, 1.0);
+    // Drop the translation so the sky stays centred on the camera
+    vec4 pos = projection * mat4(mat3(view)) * vec4(position, 1.0);
     gl_Position = pos.xyww;
     TexCoords = position;
 }  
\ No newline at end of file